@@ -1,12 +1,20 @@
 #include "aci.hpp"
 #include "../lib/db.hpp"
 #include "../lib/types.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstddef>
 #include <initializer_list>
 #include <iostream>
 #include <optional>
 #include <cstring>
+#include <charconv>
+#include <cctype>
 #include <unordered_set>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <openssl/md5.h>
 
 #include "../shared/fmt.hpp"
@@ -19,77 +27,148 @@
 namespace aci
 {
 
-	ambry::DB** Interpreter::get_wdb(int from)
+	void Interpreter::start_session(Session &session)
 	{
-		auto iter = logins.find(from);
+		std::lock_guard lock(sessions_mutex);
 
-		if (iter == logins.end())
-		{
-			return nullptr;
-		}
+		sessions.insert(&session);
+	}
 
-		return &iter->second.wdb;
+	void Interpreter::end_session(Session &session)
+	{
+		std::lock_guard lock(sessions_mutex);
+
+		sessions.erase(&session);
 	}
 
-	Result update_set_impl(Ctx &ctx, uint8_t m)
+	void Interpreter::forget_db(const OpenDB *db)
 	{
-		auto iter = ctx.cmd.args.begin();
+		for_each_session([&](Session &session)
+		{
+			if (!db || session.wdb == db)
+			{
+				session.wdb = nullptr;
+			}
+		});
+	}
 
-		const std::string &key = *iter;
+	Result update_set_impl(Ctx &ctx, uint8_t m)
+	{
+		auto &args = ctx.cmd.args;
 
-		std::string args;
+		std::string_view key = args.front();
+		std::string_view value;
 
-		iter++;
+		std::string joined;
 
-		for (; iter != ctx.cmd.args.end(); iter++)
+		// a single value is passed straight through, only multiple values have to be joined
+		if (args.size() == 2)
 		{
-			args += std::move(*iter);
+			value = args[1];
 		}
+		else
+		{
+			for (auto iter = args.begin()+1; iter < args.end(); iter++)
+			{
+				joined += *iter;
+			}
 
-		auto res = m ? ctx.wdb->set(key, args) : ctx.wdb->update(key, args);
+			value = joined;
+		}
+
+		auto res = m ? ctx.wdb->set(key, value) : ctx.wdb->update(std::string(key), value);
 
 		return TO_RES(res);
 	}
 
+	// the table is only locked to look the db up and to add it, it is opened or waited on without any lock held
 	Result open_cb(Ctx &ctx)
 	{
-		const std::string &name = ctx.cmd.args.front();
+		auto &inter = ctx.inter;
 
-		if (ctx.inter.restricted_dbs.contains(name))
+		std::string name(ctx.cmd.args.front());
+
+		if (inter.restricted_dbs.contains(name))
 		{
 			return INTER_ERR("the provided database is restricted");
 		}
 
-		auto [iter, emplaced] = ctx.inter.dbt.emplace(name, ambry::DB(name));
-		
-		if (!emplaced)
+		std::shared_future<ambry::Result> done;
+		std::promise<ambry::Result> load;
+		ambry::DB *db = nullptr;
+
 		{
-			ctx.wdb = &iter->second;
-			return {};
+			std::unique_lock lock(inter.dbs_mutex);
+
+			inter.collect_preloaded();
+
+			if (auto iter = inter.dbt.find(name); iter != inter.dbt.end())
+			{
+				ctx.session.wdb = &iter->second;
+				return {};
+			}
+
+			// another session or a preload is already opening it
+			if (auto iter = inter.pending.find(name); iter != inter.pending.end())
+			{
+				done = iter->second;
+			}
+			else
+			{
+				auto [slot, _] = inter.loading.try_emplace(name, name);
+
+				db = &slot->second.db;
+				done = load.get_future().share();
+
+				inter.pending.emplace(name, done);
+			}
 		}
 
-		ctx.wdb = &iter->second;
+		if (db)
+		{
+			auto res = db->open();
+
+			inter.loaded++;
+			load.set_value(res);
+		}
 
-		auto res = ctx.wdb->open();
+		auto res = done.get();
 
-		return TO_RES(res);
+		if (!res.ok())
+		{
+			return TO_RES(res);
+		}
+
+		std::unique_lock lock(inter.dbs_mutex);
+
+		inter.collect_preloaded();
+
+		auto iter = inter.dbt.find(name);
+
+		// it was closed again before this session got to it
+		if (iter == inter.dbt.end())
+		{
+			return KEY_NOT_FND;
+		}
+
+		ctx.session.wdb = &iter->second;
+
+		return {};
 	}
 
 	Result close_cb(Ctx &ctx)
 	{
-		auto iter = ctx.inter.dbt.find(ctx.cmd.args.front());
+		auto iter = ctx.inter.dbt.find(std::string(ctx.cmd.args.front()));
 
 		if (iter == ctx.inter.dbt.end())
 		{
 			return KEY_NOT_FND;
 		}
 
-		if (&iter->second == ctx.wdb)
-		{
-			ctx.wdb = nullptr;
-		}
+		// every session working in the db has to let go of it, not only this one
+		ctx.inter.forget_db(&iter->second);
 
-		iter->second.close();
+		iter->second.db.close();
 
 		ctx.inter.dbt.erase(iter);
 
@@ -98,21 +177,21 @@ namespace aci
 
 	Result switch_cb(Ctx &ctx)
 	{
-		auto iter = ctx.inter.dbt.find(ctx.cmd.args.front());
+		auto iter = ctx.inter.dbt.find(std::string(ctx.cmd.args.front()));
 
 		if (iter == ctx.inter.dbt.end())
 		{
 			return KEY_NOT_FND;
 		}
 
-		ctx.wdb = &iter->second;
+		ctx.session.wdb = &iter->second;
 
 		return {};
 	}
 
 	Result cache_mode_cb(Ctx &ctx)
 	{
-		const std::string &s = ctx.cmd.args.front();
+		std::string_view s = ctx.cmd.args.front();
 
 		bool on;
 
@@ -141,7 +220,7 @@ namespace aci
 
 	Result get_cb(Ctx &ctx)
 	{
-		const std::string &key = ctx.cmd.args.front();
+		std::string key { ctx.cmd.args.front() };
 
 		if (ctx.wdb->is_cached())
 		{
@@ -169,12 +248,12 @@ namespace aci
 
 	Result close_all_cb(Ctx &ctx)
 	{
-		for (auto &[_, db] : ctx.inter.dbt) 
+		for (auto &[_, open] : ctx.inter.dbt) 
 		{
-			db.close();
+			open.db.close();
 		}
 
-		ctx.wdb = nullptr;
+		ctx.inter.forget_db(nullptr);
 		ctx.inter.dbt.clear();
 
 		return {};
@@ -182,7 +261,7 @@ namespace aci
 
 	Result destroy_cb(Ctx &ctx)
 	{
-		std::string &name = ctx.cmd.args.front();
+		std::string name { ctx.cmd.args.front() };
 
 		if (ctx.inter.restricted_dbs.contains(name))
 		{
@@ -197,21 +276,18 @@ namespace aci
 			return TO_RES(result);
 		}
 
-		if (&iter->second == ctx.wdb)
-		{
-			ctx.wdb = nullptr;
-		}
+		ctx.inter.forget_db(&iter->second);
 
-		auto res = iter->second.destroy();
+		auto res = iter->second.db.destroy();
 
 		return TO_RES(res);
 	}
 
 	Result destroy_all_cb(Ctx &ctx)
 	{
-		for (auto &[_, db] : ctx.inter.dbt)
+		for (auto &[_, open] : ctx.inter.dbt)
 		{
-			ambry::Result result = db.destroy();
+			ambry::Result result = open.db.destroy();
 
 			if (!result.ok())
 			{
@@ -221,7 +297,7 @@ namespace aci
 
 		ctx.inter.dbt.clear();
 
-		ctx.wdb = nullptr;
+		ctx.inter.forget_db(nullptr);
 
 		return {};
 	}
@@ -255,9 +331,82 @@ namespace aci
 		return update_set_impl(ctx, 0);
 	}
 
+	Result incr_impl(Ctx &ctx, int64_t sign)
+	{
+		std::string_view key = ctx.cmd.args.front();
+
+		int64_t delta = 1;
+
+		if (ctx.cmd.args.size() > 1)
+		{
+			std::string_view arg = ctx.cmd.args[1];
+
+			auto [end, ec] = std::from_chars(arg.data(), arg.data()+arg.size(), delta);
+
+			if (ec != std::errc() || end != arg.data()+arg.size())
+			{
+				return INTER_ERR("delta must be an integer");
+			}
+		}
+
+		// the smallest int64 has no negative
+		if (__builtin_mul_overflow(delta, sign, &delta))
+		{
+			return INTER_ERR("integer overflow");
+		}
+
+		int64_t value;
+
+		auto res = ctx.wdb->increment(key, delta, value);
+
+		if (!res.ok())
+		{
+			return TO_RES(res);
+		}
+
+		return {{}, std::to_string(value)};
+	}
+
+	Result incr_cb(Ctx &ctx)
+	{
+		return incr_impl(ctx, 1);
+	}
+
+	Result decr_cb(Ctx &ctx)
+	{
+		return incr_impl(ctx, -1);
+	}
+
+	Result append_cb(Ctx &ctx)
+	{
+		auto iter = ctx.cmd.args.begin();
+
+		std::string key { *iter++ };
+
+		std::string args;
+
+		for (; iter != ctx.cmd.args.end(); iter++)
+		{
+			args += *iter;
+		}
+
+		auto res = ctx.wdb->append(key, args);
+
+		return TO_RES(res);
+	}
+
+	Result cas_cb(Ctx &ctx)
+	{
+		auto &args = ctx.cmd.args;
+
+		auto res = ctx.wdb->compare_and_set(std::string(args[0]), args[1], args[2]);
+
+		return TO_RES(res);
+	}
+
 	Result erase_cb(Ctx &ctx)
 	{
-		auto res = ctx.wdb->erase(ctx.cmd.args.front());
+		auto res = ctx.wdb->erase(std::string(ctx.cmd.args.front()));
 		return TO_RES(res);
 	}
 
@@ -267,9 +416,11 @@ namespace aci
 
 		output += "name - size\n";
 
-		for (auto &[_, db] : ctx.inter.dbt)
+		for (auto &[_, open] : ctx.inter.dbt)
 		{
-			output += fmt::format("{} - {}\n", db.name(), db.size());
+			std::shared_lock lock(open.mutex);
+
+			output += fmt::format("{} - {}\n", open.db.name(), open.db.size());
 		}
 
 		return {{}, output};
@@ -279,8 +430,8 @@ namespace aci
 	{
 		auto iter = ctx.cmd.args.begin();
 
-		std::string &username = *iter++;
-		std::string &password = *iter++;
+		std::string_view username = *iter++;
+		std::string_view password = *iter++;
 
 		std::string buff;
 
@@ -292,16 +443,20 @@ namespace aci
 		buff += (uint8_t)password.size();
 		buff += password;
 
+		// anyone may create the first user, which becomes the admin
 		if (ctx.inter.users.size() == 0)
 		{
 			buff += (uint8_t)5;
 			buff += "admin";
 
-			ctx.inter.ct["create_user"].perms = ADMIN;
-
 			goto set;
 		}
 
+		if (!ctx.session.perms().test(CREATE_USER))
+		{
+			return INTER_ERR("you do not meet the permissions to execute this command");
+		}
+
 		for (; iter != ctx.cmd.args.end(); iter++)
 		{
 			if (iter->size() > 255)
@@ -309,7 +464,7 @@ namespace aci
 				return INTER_ERR("role length must be less then 256 chars");
 			}
 
-			if (!ctx.inter.roles.contains(*iter))
+			if (!ctx.inter.roles.contains(std::string(*iter)))
 			{
 				return INTER_ERR("invalid rolename provided");
 			}
@@ -320,6 +475,8 @@ namespace aci
 set:
 		auto res = ctx.inter.users.set(username, buff);
 
+		ctx.inter.refresh_user(username);
+
 		return TO_RES(res);
 	}
 
@@ -327,7 +484,7 @@ set:
 	{
 		auto iter = ctx.cmd.args.begin();
 
-		std::string &name = *iter++;
+		std::string_view name = *iter++;
 
 		if (name.size() > 256)
 		{
@@ -352,6 +509,8 @@ set:
 
 		auto res = ctx.inter.roles.set(name, {(char*)&ulong, sizeof(ulong)});
 
+		ctx.inter.refresh_role(name);
+
 		return TO_RES(res);
 	}
 
@@ -363,13 +522,13 @@ set:
 
 	Result login_cb(Ctx &ctx)
 	{
-		if (ctx.inter.logins.contains(ctx.fd))
+		if (ctx.session.login)
 		{
 			return INTER_ERR("you are already logged in to a user account");
 		}
 
-		std::string &username = ctx.cmd.args[0];
-		std::string &password = ctx.cmd.args[1];
+		std::string username { ctx.cmd.args[0] };
+		std::string_view password = ctx.cmd.args[1];
 
 		auto opt = ctx.inter.users.get(username);
 
@@ -387,7 +546,14 @@ set:
 			return INTER_ERR("password does not match");
 		}
 
-		ctx.inter.logins.emplace(ctx.fd, std::move(username));
+		Login login { std::move(username) };
+
+		FlagT perms = ctx.inter.load_perms(login);
+
+		std::lock_guard lock(ctx.inter.sessions_mutex);
+
+		ctx.session.login = std::move(login);
+		ctx.session.granted = perms;
 
 		return {};
 	}
@@ -396,7 +562,7 @@ set:
 	{
 		auto iter = ctx.cmd.args.begin();
 
-		std::string &username = *iter++;
+		std::string username { *iter++ };
 
 		auto opt = ctx.inter.users.get(username);
 
@@ -409,7 +575,7 @@ set:
 
 		for (; iter != ctx.cmd.args.end(); iter++)
 		{
-			if (!ctx.inter.roles.contains(*iter))
+			if (!ctx.inter.roles.contains(std::string(*iter)))
 			{
 				return INTER_ERR("invalid role name provided");
 			}
@@ -420,6 +586,8 @@ set:
 
 		auto res = ctx.inter.users.update(username, data);
 
+		ctx.inter.refresh_user(username);
+
 		return TO_RES(res);
 	}
 
@@ -427,7 +595,7 @@ set:
 	{
 		auto iter = ctx.cmd.args.begin();
 
-		std::string &username = *iter++;
+		std::string username { *iter++ };
 
 		auto opt = ctx.inter.users.get(username);
 
@@ -458,44 +626,52 @@ set:
 				continue;
 			}
 
-			buff += (uint8_t)iter->size();
-			buff += *iter;
-
-			iter++;
+			buff += (uint8_t)role.size();
+			buff += role;
 		}
 
 		auto res = ctx.inter.users.update(username, buff);
 
+		ctx.inter.refresh_user(username);
+
 		return TO_RES(res);
 	}
 
 	Result logout_cb(Ctx &ctx)
 	{
-		ctx.inter.logins.erase(ctx.fd);
+		std::lock_guard lock(ctx.inter.sessions_mutex);
+
+		ctx.session.login.reset();
+		ctx.session.granted = FlagT();
+		ctx.session.wdb = nullptr;
 		return {};
 	}
 
 	Result delete_user_cb(Ctx &ctx)
 	{
-		ambry::Result result = ctx.inter.users.erase(ctx.cmd.args.front());
+		ambry::Result result = ctx.inter.users.erase(std::string(ctx.cmd.args.front()));
 
 		if (!result.ok())
 		{
 			return INTER_ERR("the provided user does not exist");
 		}
 
+		ctx.inter.refresh_user(ctx.cmd.args.front());
+
 		return {};
 	}
 
 	Result delete_role_cb(Ctx &ctx)
 	{
-		ambry::Result result = ctx.inter.roles.erase(ctx.cmd.args.front());
+		ambry::Result result = ctx.inter.roles.erase(std::string(ctx.cmd.args.front()));
 
 		if (!result.ok())
 		{
 			return INTER_ERR("the provided rolename does not exist");
 		}
 
+		ctx.inter.refresh_role(ctx.cmd.args.front());
+
 		return {};
 	}
 
@@ -503,10 +679,13 @@ set:
 	{
 		std::string output;
 
-		for (auto &[_, login] : ctx.inter.logins)
+		ctx.inter.for_each_session([&](Session &session)
 		{
-			output += login.name + '\n';
-		}
+			if (session.login)
+			{
+				output += session.login->name + '\n';
+			}
+		});
 
 		return {{}, output};
 	}
@@ -556,7 +735,7 @@ set:
 	{
 		std::string output;
 
-		auto opt = ctx.inter.users.get(ctx.cmd.args.front());
+		auto opt = ctx.inter.users.get(std::string(ctx.cmd.args.front()));
 
 		if (!opt)
 		{
@@ -604,123 +783,793 @@ set:
 		return {{}, std::string{ ctx.wdb->name() }};
 	}
 
-	void Interpreter::init_commands()
+	/*
+		the names of the default commands hash into a table without any collisions.
+		the seed that makes this work is searched for at compile time so finding a default command
+		is one hash and one compare
+	*/
+	namespace builtin
 	{
-		ct["create_user"] = 
-		{
-			.arity = 2,
-			.description = "creates a new user account",
-			.usage = " <user name> <password> [role] ...",
-			.fn = create_user_cb,
-			.expect_wdb = false,
-			.perms = users.size() == 0 ? 0 : set_perms(CREATE_USER),
-		};
+		constexpr auto &names = opcodes;
 
-		ct["working_db"] = 
-		{
-			.description = "returns the working db name",
-			.fn = working_db_cb,
-			.perms = set_perms(INFO),
-		};
+		// a sparse table keeps the seed search short
+		constexpr size_t SLOTS = std::bit_ceil(std::size(names)) * 4;
 
-		ct["show_users"] = 
+		constexpr size_t slot(std::string_view name, uint64_t seed)
 		{
-			.description = "returns a list of all users",
-			.fn = show_users_cb,
-			.expect_wdb = false,
-			.perms = set_perms(INFO),
-		};
+			uint64_t h = 14695981039346656037ull ^ seed;
 
-		ct["user_roles"] = 
-		{
-			.arity = 1,
-			.description = "show all the roles a user has",
-			.usage = " <user name>",
-			.fn = user_roles_cb,
-			.expect_wdb = false,
-			.perms = set_perms(INFO),
-		};
+			for (char c : name)
+			{
+				h ^= uint8_t(c);
+				h *= 1099511628211ull;
+			}
 
-		ct["active_users"] = 
-		{
-			.description = "returns a list of active users",
-			.fn = active_users_cb,
-			.expect_wdb = false,
-			.perms = set_perms(INFO),
-		};
+			return (h ^ (h >> 32)) & (SLOTS - 1);
+		}
 
-		ct["show_roles"] = 
+		constexpr uint64_t find_seed()
 		{
-			.description = "returns a list of roles",
-			.fn = show_roles_cb,
-			.expect_wdb = false,
-			.perms = set_perms(INFO),
-		};
+			for (uint64_t seed = 0;; seed++)
+			{
+				bool used[SLOTS] {};
+				bool collided = false;
 
-		ct["delete_role"] = 
-		{
-			.arity = 1,
-			.description = "deletes a role by its name",
-			.usage = " <role name>",
-			.fn = delete_role_cb,
-			.expect_wdb = false,
-			.perms = set_perms(DELETE_ROLE)
-		};
+				for (auto name : names)
+				{
+					size_t n = slot(name, seed);
 
-		ct["create_role"] = 
+					collided |= used[n];
+					used[n] = true;
+				}
+
+				if (!collided)
+				{
+					return seed;
+				}
+			}
+		}
+
+		constexpr uint64_t SEED = find_seed();
+
+		// the name that belongs in every slot so a lookup can reject names that are not in the table
+		constexpr auto table = []
 		{
-			.arity = 1,
-			.description = "creates a new role with permissions",
-			.usage = " <role name> <permission> ...",
-			.fn = create_role_cb,
-			.expect_wdb = false,
-			.perms = set_perms(CREATE_ROLE)
-		};
+			std::array<std::string_view, SLOTS> table {};
 
-		ct["delete_user"] = 
+			for (auto name : names)
+			{
+				table[slot(name, SEED)] = name;
+			}
+
+			return table;
+		}();
+	}
+
+	std::optional<uint8_t> opcode_of(std::string_view name)
+	{
+		size_t n = builtin::slot(name, builtin::SEED);
+
+		if (builtin::table[n] != name)
 		{
-			.arity = 1,
-			.description = "deletes a user",
-			.usage = " <user name>",
-			.fn = delete_user_cb,
-			.expect_wdb = false,
-			.perms = set_perms(DELETE_USER)
-		};
+			return std::nullopt;
+		}
 
-		ct["login"] = 
+		return std::find(std::begin(opcodes), std::end(opcodes), name) - std::begin(opcodes);
+	}
+
+	void Interpreter::compile_commands()
+	{
+		builtins.assign(builtin::SLOTS, nullptr);
+		by_opcode.assign(std::size(opcodes), nullptr);
+
+		for (size_t i = 0; i < std::size(opcodes); i++)
 		{
-			.arity = 2,
-			.description = "login command",
-			.usage = " <username> <password>",
-			.fn = login_cb,
-			.expect_wdb = false,
-		};
+			auto iter = ct.find(opcodes[i]);
 
-		ct["logout"] = 
+			if (iter != ct.end())
+			{
+				builtins[builtin::slot(opcodes[i], builtin::SEED)] = &iter->second;
+				by_opcode[i] = &iter->second;
+			}
+		}
+	}
+
+	std::shared_ptr<const expr::Program> Interpreter::compile(std::string_view source, std::string &error)
+	{
 		{
-			.description = "logs out the command sender or does nothing if the command sender is not logged in",
-			.fn = logout_cb,
-			.expect_wdb = false,
-		};
+			std::lock_guard lock(programs_mutex);
 
-		ct["add_roles"] = 
+			auto iter = programs.find(source);
+
+			if (iter != programs.end())
+			{
+				return iter->second;
+			}
+		}
+
+		auto program = expr::compile(source, error);
+
+		if (!program)
 		{
-			.arity = 2,
-			.description = "adds any number of roles to a provided user",
-			.usage = " <username> <role> ...",
-			.fn = add_roles_cb,
-			.expect_wdb = false,
-			.perms = set_perms(ADD_ROLES)
-		};
+			return nullptr;
+		}
 
-		ct["remove_roles"] = 
+		auto shared = std::make_shared<const expr::Program>(std::move(*program));
+
+		std::lock_guard lock(programs_mutex);
+
+		// the cache only has to hold the expressions in use so it is simply started over when full.
+		// a program is shared so one still being evaluated outlives the clear
+		if (programs.size() >= MAX_PROGRAMS)
 		{
-			.arity = 2,
+			programs.clear();
+		}
+
+		programs.emplace(source, shared);
+
+		return shared;
+	}
+
+	CmdHandle *Interpreter::find_command(std::string_view name)
+	{
+		if (!builtins.empty())
+		{
+			size_t n = builtin::slot(name, builtin::SEED);
+
+			if (builtin::table[n] == name && builtins[n])
+			{
+				return builtins[n];
+			}
+		}
+
+		auto iter = ct.find(name);
+
+		return iter == ct.end() ? nullptr : &iter->second;
+	}
+
+	Result when_cb(Ctx &ctx)
+	{
+		auto &args = ctx.cmd.args;
+
+		std::string key { args[0] };
+		std::string_view action = args[2];
+
+		FlagT needed;
+
+		if (action == "set" || action == "update")
+		{
+			if (args.size() < 4)
+			{
+				return INTER_ERR("expected a value to write");
+			}
+
+			needed = set_perms(action == "set" ? SET : UPDATE);
+		}
+		else if (action == "erase")
+		{
+			needed = set_perms(ERASE);
+		}
+		else
+		{
+			return INTER_ERR("expected set, update or erase");
+		}
+
+		if ((ctx.session.perms() & needed) != needed)
+		{
+			return INTER_ERR("you do not meet the permissions to execute this command");
+		}
+
+		std::string error;
+
+		auto program = ctx.inter.compile(args[1], error);
+
+		if (!program)
+		{
+			return {ambry::ResultType::ParseError, std::move(error)};
+		}
+
+		std::optional<std::string> copy;
+		expr::Input input;
+
+		if (ctx.wdb->is_cached())
+		{
+			input.value = ctx.wdb->get_cached(key);
+		}
+		else if ((copy = ctx.wdb->get(key)))
+		{
+			input.value = *copy;
+		}
+
+		expr::Outcome outcome = expr::evaluate(*program, input);
+
+		if (!outcome.ok)
+		{
+			return INTER_ERR(std::string(outcome.error));
+		}
+
+		if (!outcome.result)
+		{
+			return {{}, "0"};
+		}
+
+		ambry::Result res;
+
+		if (action == "erase")
+		{
+			res = ctx.wdb->erase(key);
+		}
+		else
+		{
+			std::string value;
+
+			for (auto iter = args.begin()+3; iter < args.end(); iter++)
+			{
+				value += *iter;
+			}
+
+			res = action == "set" ? ctx.wdb->set(key, value) : ctx.wdb->update(key, value);
+		}
+
+		if (!res.ok())
+		{
+			return TO_RES(res);
+		}
+
+		return {{}, "1"};
+	}
+
+	/*
+		adds one value of a response holding several. binary connections get [u32 length][bytes]
+		so values can hold anything, text connections get a value per line
+	*/
+	void put_value(Ctx &ctx, std::string &out, std::string_view value)
+	{
+		if (ctx.session.protocol == Protocol::Binary)
+		{
+			uint32_t len = value.size();
+			out.append((char*)&len, sizeof(len));
+		}
+
+		out += value;
+
+		if (ctx.session.protocol == Protocol::Text)
+		{
+			out += '\n';
+		}
+	}
+
+	// the most keys a single scan call will look at
+	constexpr size_t MAX_SCAN_COUNT = 10000;
+
+	Result scan_cb(Ctx &ctx)
+	{
+		auto &args = ctx.cmd.args;
+
+		uint64_t cursor;
+		size_t count = 10;
+
+		auto [end, ec] = std::from_chars(args[0].data(), args[0].data()+args[0].size(), cursor);
+
+		if (ec != std::errc() || end != args[0].data()+args[0].size())
+		{
+			return INTER_ERR("cursor must be a number");
+		}
+
+		if (args.size() > 1)
+		{
+			auto [end, ec] = std::from_chars(args[1].data(), args[1].data()+args[1].size(), count);
+
+			if (ec != std::errc() || end != args[1].data()+args[1].size())
+			{
+				return INTER_ERR("count must be a number");
+			}
+		}
+
+		std::string_view pattern = args.size() > 2 ? args[2] : "";
+
+		std::string keys;
+
+		uint64_t next = ctx.wdb->scan(cursor, std::min(count, MAX_SCAN_COUNT), pattern, [&](std::string_view key)
+		{
+			put_value(ctx, keys, key);
+		});
+
+		// the next cursor comes first and then the keys
+		std::string output;
+
+		put_value(ctx, output, std::to_string(next));
+
+		output += keys;
+
+		return {{}, std::move(output)};
+	}
+
+	// a missing value of a multi value response. binary connections get a length of UINT32_MAX, text connections an empty line
+	void put_missing(Ctx &ctx, std::string &out)
+	{
+		if (ctx.session.protocol == Protocol::Binary)
+		{
+			uint32_t len = UINT32_MAX;
+			out.append((char*)&len, sizeof(len));
+		}
+		else
+		{
+			out += '\n';
+		}
+	}
+
+	Result mget_cb(Ctx &ctx)
+	{
+		std::vector<std::optional<std::string_view>> values;
+		std::string scratch;
+
+		auto res = ctx.wdb->get_many(ctx.cmd.args, values, scratch);
+
+		if (!res.ok())
+		{
+			return TO_RES(res);
+		}
+
+		std::string output;
+
+		for (const auto &value : values)
+		{
+			if (value)
+			{
+				put_value(ctx, output, *value);
+			}
+			else
+			{
+				put_missing(ctx, output);
+			}
+		}
+
+		return {{}, std::move(output)};
+	}
+
+	Result mset_cb(Ctx &ctx)
+	{
+		auto &args = ctx.cmd.args;
+
+		if (args.size() % 2 != 0)
+		{
+			return INTER_ERR("expected pairs of keys and values");
+		}
+
+		// every key is checked first so either all of the values are set or none are
+		std::unordered_set<std::string_view> keys;
+		std::string lookup;
+
+		for (size_t i = 0; i < args.size(); i += 2)
+		{
+			lookup.assign(args[i]);
+
+			if (!keys.insert(args[i]).second || ctx.wdb->contains(lookup))
+			{
+				return {ambry::ResultType::KeyNotInserted, "a key already exists"};
+			}
+		}
+
+		auto tr = ctx.wdb->begin_transaction();
+
+		for (size_t i = 0; i < args.size(); i += 2)
+		{
+			tr.set(args[i], args[i+1]);
+		}
+
+		auto res = tr.commit();
+
+		return TO_RES(res);
+	}
+
+	Result mdel_cb(Ctx &ctx)
+	{
+		size_t erased = 0;
+		std::string key;
+
+		for (auto arg : ctx.cmd.args)
+		{
+			key.assign(arg);
+
+			if (ctx.wdb->erase(key).ok())
+			{
+				erased++;
+			}
+		}
+
+		return {{}, std::to_string(erased)};
+	}
+
+	// parses an arg that has to be a number and nothing else
+	template<class T>
+	bool parse_number(std::string_view arg, T &out)
+	{
+		auto [end, ec] = std::from_chars(arg.data(), arg.data()+arg.size(), out);
+
+		return ec == std::errc() && end == arg.data()+arg.size();
+	}
+
+	Result latency_cb(Ctx &ctx)
+	{
+		auto &args = ctx.cmd.args;
+
+		if (!args.empty() && args[0] == "reset")
+		{
+			for (auto &[_, handle] : ctx.inter.ct)
+			{
+				handle.latency->reset();
+			}
+
+			return {};
+		}
+
+		std::vector<std::string_view> names;
+
+		if (!args.empty())
+		{
+			if (!ctx.inter.find_command(args[0]))
+			{
+				return INTER_ERR("command does not exist");
+			}
+
+			names.push_back(args[0]);
+		}
+		else
+		{
+			for (auto &[name, _] : ctx.inter.ct)
+			{
+				names.push_back(name);
+			}
+
+			std::sort(names.begin(), names.end());
+		}
+
+		std::string output;
+
+		for (auto name : names)
+		{
+			auto snapshot = ctx.inter.find_command(name)->latency->snapshot();
+
+			// commands that never ran are left out unless they were asked for
+			if (snapshot.count == 0 && args.empty())
+			{
+				continue;
+			}
+
+			put_value(ctx, output, fmt::format("{} calls={} mean={} p50={} p99={} p999={} max={}",
+				name, snapshot.count, uint64_t(snapshot.mean()), snapshot.percentile(50),
+				snapshot.percentile(99), snapshot.percentile(99.9), snapshot.max));
+		}
+
+		return {{}, std::move(output)};
+	}
+
+	Result slowlog_cb(Ctx &ctx)
+	{
+		auto &args = ctx.cmd.args;
+		auto &inter = ctx.inter;
+
+		std::string_view sub = args.empty() ? "get" : args[0];
+
+		std::lock_guard lock(inter.slowlog_mutex);
+
+		if (sub == "get")
+		{
+			size_t n = 10;
+
+			if (args.size() > 1 && !parse_number(args[1], n))
+			{
+				return INTER_ERR("count must be a number");
+			}
+
+			std::string output;
+
+			for (size_t i = 0; i < std::min(n, inter.slowlog.size()); i++)
+			{
+				auto &entry = inter.slowlog[i];
+
+				auto line = fmt::format("{} {} {} {} {}", entry.id, entry.time, entry.ns, entry.user.empty() ? "-" : entry.user, entry.command);
+
+				if (!entry.args.empty())
+				{
+					line += ' ';
+					line += entry.args;
+				}
+
+				put_value(ctx, output, line);
+			}
+
+			return {{}, std::move(output)};
+		}
+		else if (sub == "len")
+		{
+			return {{}, std::to_string(inter.slowlog.size())};
+		}
+		else if (sub == "reset")
+		{
+			inter.slowlog.clear();
+			return {};
+		}
+		else if (sub == "threshold")
+		{
+			if (args.size() < 2)
+			{
+				return {{}, std::to_string(inter.slowlog_threshold / 1000)};
+			}
+
+			uint64_t us;
+
+			if (!parse_number(args[1], us))
+			{
+				return INTER_ERR("threshold must be a number of microseconds");
+			}
+
+			inter.slowlog_threshold = us * 1000;
+
+			return {};
+		}
+
+		return INTER_ERR("expected get, len, reset or threshold");
+	}
+
+	void db_stats(StatFields &out, std::string_view name, OpenDB &open)
+	{
+		std::shared_lock lock(open.mutex);
+
+		const ambry::DB &db = open.db;
+
+		auto usage = db.usage();
+		auto stats = db.stats();
+
+		auto add = [&](std::string_view field, const auto &value)
+		{
+			out.emplace_back(fmt::format("db.{}.{}", name, field), fmt::string_of(value));
+		};
+
+		add("keys", usage.keys);
+		add("cached", size_t(db.is_cached()));
+		add("index_bytes", usage.index_bytes);
+		add("cache_bytes", usage.cache_bytes);
+		add("dat_bytes", usage.dat_bytes);
+		add("idx_bytes", usage.idx_bytes);
+		add("free_bytes", usage.free_bytes);
+		add("free_entries", usage.free_entries);
+		add("free_space", usage.free_space);
+		add("fragmentation", usage.fragmentation());
+		add("gets", stats.gets);
+		add("get_misses", stats.get_misses);
+		add("cache_hits", stats.cache_hits);
+		add("hit_rate", stats.hit_rate());
+		add("sets", stats.sets);
+		add("updates", stats.updates);
+		add("erases", stats.erases);
+		add("bytes_read", stats.bytes_read);
+		add("bytes_written", stats.bytes_written);
+		add("free_reuse", stats.free_reuse);
+		add("syscalls", stats.syscalls);
+	}
+
+	Result stats_cb(Ctx &ctx)
+	{
+		auto &inter = ctx.inter;
+
+		StatFields fields;
+
+		if (!ctx.cmd.args.empty())
+		{
+			std::string_view name = ctx.cmd.args[0];
+
+			auto iter = inter.dbt.find(std::string(name));
+
+			if (iter == inter.dbt.end() || inter.restricted_dbs.contains(name))
+			{
+				return KEY_NOT_FND;
+			}
+
+			db_stats(fields, name, iter->second);
+		}
+		else
+		{
+			if (inter.server_stats)
+			{
+				inter.server_stats(fields);
+			}
+
+			size_t sessions = 0, logins = 0;
+
+			inter.for_each_session([&](Session &session)
+			{
+				sessions++;
+				logins += session.login.has_value();
+			});
+
+			fields.emplace_back("aci.sessions", std::to_string(sessions));
+			fields.emplace_back("aci.logins", std::to_string(logins));
+			fields.emplace_back("aci.open_dbs", std::to_string(inter.dbt.size()));
+			fields.emplace_back("aci.loading_dbs", std::to_string(inter.pending.size()));
+			{
+				std::lock_guard lock(inter.slowlog_mutex);
+				fields.emplace_back("aci.slowlog_len", std::to_string(inter.slowlog.size()));
+			}
+
+			// sorted so the order is the same every time
+			std::vector<std::string_view> names;
+
+			for (const auto &[name, _] : inter.dbt)
+			{
+				names.push_back(name);
+			}
+
+			std::sort(names.begin(), names.end());
+
+			for (auto name : names)
+			{
+				db_stats(fields, name, inter.dbt.at(std::string(name)));
+			}
+		}
+
+		std::string output;
+
+		for (const auto &[field, value] : fields)
+		{
+			put_value(ctx, output, fmt::format("{} {}", field, value));
+		}
+
+		return {{}, std::move(output)};
+	}
+
+	Result protocol_cb(Ctx &ctx)
+	{
+		std::string_view name = ctx.cmd.args.front();
+
+		if (name == "text")
+		{
+			ctx.session.protocol = Protocol::Text;
+		}
+		else if (name == "binary")
+		{
+			ctx.session.protocol = Protocol::Binary;
+		}
+		else
+		{
+			return INTER_ERR("expected text or binary");
+		}
+
+		return {};
+	}
+
+	void Interpreter::init_commands()
+	{
+		ct["create_user"] = 
+		{
+			.arity = 2,
+			.description = "creates a new user account",
+			.usage = " <user name> <password> [role] ...",
+			.fn = create_user_cb,
+			.expect_wdb = false,
+			.access = Access::WriteAccounts,
+			.secret_args = true,
+		};
+
+		ct["working_db"] = 
+		{
+			.description = "returns the working db name",
+			.fn = working_db_cb,
+			.perms = set_perms(INFO),
+			.access = Access::ReadTable,
+		};
+
+		ct["show_users"] = 
+		{
+			.description = "returns a list of all users",
+			.fn = show_users_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::ReadAccounts,
+		};
+
+		ct["user_roles"] = 
+		{
+			.arity = 1,
+			.description = "show all the roles a user has",
+			.usage = " <user name>",
+			.fn = user_roles_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::ReadAccounts,
+		};
+
+		ct["active_users"] = 
+		{
+			.description = "returns a list of active users",
+			.fn = active_users_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::Session,
+		};
+
+		ct["show_roles"] = 
+		{
+			.description = "returns a list of roles",
+			.fn = show_roles_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::ReadAccounts,
+		};
+
+		ct["delete_role"] = 
+		{
+			.arity = 1,
+			.description = "deletes a role by its name",
+			.usage = " <role name>",
+			.fn = delete_role_cb,
+			.expect_wdb = false,
+			.perms = set_perms(DELETE_ROLE),
+			.access = Access::WriteAccounts,
+		};
+
+		ct["create_role"] = 
+		{
+			.arity = 1,
+			.description = "creates a new role with permissions",
+			.usage = " <role name> <permission> ...",
+			.fn = create_role_cb,
+			.expect_wdb = false,
+			.perms = set_perms(CREATE_ROLE),
+			.access = Access::WriteAccounts,
+		};
+
+		ct["delete_user"] = 
+		{
+			.arity = 1,
+			.description = "deletes a user",
+			.usage = " <user name>",
+			.fn = delete_user_cb,
+			.expect_wdb = false,
+			.perms = set_perms(DELETE_USER),
+			.access = Access::WriteAccounts,
+		};
+
+		ct["login"] = 
+		{
+			.arity = 2,
+			.description = "login command",
+			.usage = " <username> <password>",
+			.fn = login_cb,
+			.expect_wdb = false,
+			.access = Access::ReadAccounts,
+			.secret_args = true,
+		};
+
+		ct["logout"] = 
+		{
+			.description = "logs out the command sender or does nothing if the command sender is not logged in",
+			.fn = logout_cb,
+			.expect_wdb = false,
+			.access = Access::ReadTable,
+		};
+
+		ct["add_roles"] = 
+		{
+			.arity = 2,
+			.description = "adds any number of roles to a provided user",
+			.usage = " <username> <role> ...",
+			.fn = add_roles_cb,
+			.expect_wdb = false,
+			.perms = set_perms(ADD_ROLES),
+			.access = Access::WriteAccounts,
+		};
+
+		ct["remove_roles"] = 
+		{
+			.arity = 2,
 			.description = "removes any number of roles to a provided user",
 			.usage = " <username> <role> ...",
 			.fn = remove_roles_cb,
 			.expect_wdb = false,
-			.perms = set_perms(REMOVE_ROLES)
+			.perms = set_perms(REMOVE_ROLES),
+			.access = Access::WriteAccounts,
 		};
 
 		ct["open"] = 
@@ -730,7 +1579,8 @@ set:
 			.usage = " <db_name>",
 			.fn = open_cb,
 			.expect_wdb = false,
-			.perms = set_perms(OPEN)
+			.perms = set_perms(OPEN),
+			.access = Access::Session,
 		};
 
 		ct["close"] = 
@@ -740,7 +1590,8 @@ set:
 			.usage = " <db_name>",
 			.fn = close_cb,
 			.expect_wdb = false,
-			.perms = set_perms(CLOSE)
+			.perms = set_perms(CLOSE),
+			.access = Access::WriteTable,
 		};
 
 		ct["switch"] = 
@@ -750,6 +1601,7 @@ set:
 			.usage = " <db_name>",
 			.fn = switch_cb,
 			.expect_wdb = false,
+			.access = Access::ReadTable,
 		};
 
 		ct["cache_mode"] = 
@@ -758,7 +1610,8 @@ set:
 			.description = "turns the cache mode either on or off",
 			.usage = " <on/off>",
 			.fn = cache_mode_cb,
-			.perms = set_perms(CHANGE_OPT)
+			.perms = set_perms(CHANGE_OPT),
+			.access = Access::WriteDB,
 		};
 
 		ct["set"] = 
@@ -768,6 +1621,7 @@ set:
 			.usage = " <key> <value> <...>",
 			.fn = set_cb,
 			.perms = set_perms(SET),
+			.access = Access::WriteDB,
 		};
 
 		ct["update"] = 
@@ -776,168 +1630,541 @@ set:
 			.description = "updates a value to the working database. any additional values will be concatenated together",
 			.usage = " <key> <value> <...>",
 			.fn = update_cb,
-			.perms = set_perms(UPDATE)
+			.perms = set_perms(UPDATE),
+			.access = Access::WriteDB,
+		};
+
+		ct["get"] = 
+		{
+			.arity = 1,
+			.description = "gets a value from the workind database from the given key",
+			.usage = " <key>",
+			.fn = get_cb,
+			.perms = set_perms(GET),
+			.access = Access::ReadDB,
+		};
+
+		ct["erase"] = 
+		{
+			.arity = 1,
+			.description = "erases a value from the workind database from the given key",
+			.usage = " <key>",
+			.fn = erase_cb,
+			.perms = set_perms(ERASE),
+			.access = Access::WriteDB,
+		};
+
+		ct["incr"] = 
+		{
+			.arity = 1,
+			.description = "increments an integer value by delta (1 by default) and returns the new value. a missing key starts at 0",
+			.usage = " <key> [delta]",
+			.fn = incr_cb,
+			.perms = set_perms(SET, UPDATE),
+			.access = Access::WriteDB,
+		};
+
+		ct["decr"] = 
+		{
+			.arity = 1,
+			.description = "decrements an integer value by delta (1 by default) and returns the new value. a missing key starts at 0",
+			.usage = " <key> [delta]",
+			.fn = decr_cb,
+			.perms = set_perms(SET, UPDATE),
+			.access = Access::WriteDB,
+		};
+
+		ct["append"] = 
+		{
+			.arity = 2,
+			.description = "appends to the end of a value. any additional values will be concatenated together",
+			.usage = " <key> <value> <...>",
+			.fn = append_cb,
+			.perms = set_perms(UPDATE),
+			.access = Access::WriteDB,
+		};
+
+		ct["cas"] = 
+		{
+			.arity = 3,
+			.description = "sets a value only if it currently equals the expected value",
+			.usage = " <key> <expected> <value>",
+			.fn = cas_cb,
+			.perms = set_perms(UPDATE),
+			.access = Access::WriteDB,
+		};
+
+		ct["close_all"] = 
+		{
+			.arity = 0,
+			.description = "closes all open databases",
+			.usage = "",
+			.fn = close_all_cb,
+			.perms = set_perms(CLOSE),
+			.access = Access::WriteTable,
+		};
+
+		ct["destroy"] = 
+		{
+			.arity = 1,
+			.description = "destroys a database by its name (does not need to be open)",
+			.usage = " <db_name>",
+			.fn = destroy_cb,
+			.expect_wdb = false,
+			.perms = set_perms(DESTROY),
+			.access = Access::WriteTable,
+		};
+
+		ct["destroy_all"] = 
+		{
+			.arity = 0,
+			.description = "destroys all open databases",
+			.usage = "",
+			.fn = destroy_all_cb,
+			.perms = set_perms(DESTROY),
+			.access = Access::WriteTable,
+		};
+
+		ct["cmds"] = 
+		{
+			.arity = 0,
+			.description = "displays all commands",
+			.usage = "",
+			.fn = cmds_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::Session,
+		};
+
+		ct["list_open"] = 
+		{
+			.arity = 0,
+			.description = "displays all open databases",
+			.usage = "",
+			.fn = list_open_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::ReadTable,
+		};
+
+		ct["when"] = 
+		{
+			.arity = 3,
+			.description = "runs an expression against the current value of a key and only writes if it is true. returns 1 if it wrote and 0 if not",
+			.usage = " <key> <expression> <set/update/erase> [value] ...",
+			.fn = when_cb,
+			.perms = set_perms(GET),
+			.access = Access::WriteDB,
 		};
 
-		ct["get"] = 
+		ct["scan"] = 
 		{
 			.arity = 1,
-			.description = "gets a value from the workind database from the given key",
-			.usage = " <key>",
-			.fn = get_cb,
+			.description = "returns the next cursor and then a page of keys. start with cursor 0 and stop when it returns 0. count is roughly how many keys a page looks at",
+			.usage = " <cursor> [count] [glob pattern]",
+			.fn = scan_cb,
 			.perms = set_perms(GET),
+			.access = Access::ReadDB,
 		};
 
-		ct["erase"] = 
+		ct["mget"] = 
 		{
 			.arity = 1,
-			.description = "erases a value from the workind database from the given key",
-			.usage = " <key>",
-			.fn = erase_cb,
-			.perms = set_perms(ERASE)
+			.description = "gets several values at once. missing keys get an empty line, or a length of UINT32_MAX on binary connections",
+			.usage = " <key> ...",
+			.fn = mget_cb,
+			.perms = set_perms(GET),
+			.access = Access::ReadDB,
 		};
 
-		ct["close_all"] = 
+		ct["mset"] = 
 		{
-			.arity = 0,
-			.description = "closes all open databases",
-			.usage = "",
-			.fn = close_all_cb,
-			.perms = set_perms(CLOSE)
+			.arity = 2,
+			.description = "sets several values at once. if any of the keys already exist nothing is set",
+			.usage = " <key> <value> ...",
+			.fn = mset_cb,
+			.perms = set_perms(SET),
+			.access = Access::WriteDB,
 		};
 
-		ct["destroy"] = 
+		ct["mdel"] = 
 		{
 			.arity = 1,
-			.description = "destroys a database by its name (does not need to be open)",
-			.usage = " <db_name>",
-			.fn = destroy_cb,
-			.expect_wdb = false,
-			.perms = set_perms(DESTROY),
+			.description = "erases several keys at once and returns how many existed",
+			.usage = " <key> ...",
+			.fn = mdel_cb,
+			.perms = set_perms(ERASE),
+			.access = Access::WriteDB,
 		};
 
-		ct["destroy_all"] = 
+		ct["latency"] = 
 		{
 			.arity = 0,
-			.description = "destroys all open databases",
-			.usage = "",
-			.fn = destroy_all_cb,
-			.perms = set_perms(DESTROY)
+			.description = "shows how many times each command ran and its mean, p50, p99, p99.9 and max latency in nanoseconds. reset clears them",
+			.usage = " [command/reset]",
+			.fn = latency_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::Session,
 		};
 
-		ct["cmds"] = 
+		ct["slowlog"] = 
 		{
 			.arity = 0,
-			.description = "displays all commands",
-			.usage = "",
-			.fn = cmds_cb,
+			.description = "shows the newest commands that ran for longer than the threshold as: id, unix time, nanoseconds, user, command and args",
+			.usage = " [get [count]/len/reset/threshold [microseconds]]",
+			.fn = slowlog_cb,
 			.expect_wdb = false,
-			.perms = set_perms(INFO)
+			.perms = set_perms(INFO),
+			.access = Access::Session,
 		};
 
-		ct["list_open"] = 
+		ct["stats"] = 
 		{
 			.arity = 0,
-			.description = "displays all open databases",
-			.usage = "",
-			.fn = list_open_cb,
+			.description = "reports the server, the interpreter and every open database (or only the given one) as a line of '<field> <value>' per stat",
+			.usage = " [db_name]",
+			.fn = stats_cb,
+			.expect_wdb = false,
+			.perms = set_perms(INFO),
+			.access = Access::ReadTable,
+		};
+
+		ct["protocol"] = 
+		{
+			.arity = 1,
+			.description = "switches the connection between the text and binary protocols for the messages after this one",
+			.usage = " <text/binary>",
+			.fn = protocol_cb,
 			.expect_wdb = false,
-			.perms = set_perms(INFO)
+			.access = Access::Session,
 		};
+
+		compile_commands();
 	}
 
-	bool Interpreter::calculate_perms(int from, FlagT needed)
+	Interpreter::~Interpreter()
 	{
-		if (needed == 0)
+		for (auto &loader : loaders)
 		{
-			return true;
+			loader.join();
 		}
+	}
+
+	void Interpreter::preload(const std::vector<std::string> &names, size_t threads)
+	{
+		struct Job
+		{
+			ambry::DB *db;
+			std::promise<ambry::Result> done;
+		};
+
+		std::unique_lock lock(dbs_mutex);
+
+		auto jobs = std::make_shared<std::vector<Job>>();
+		auto next = std::make_shared<std::atomic<size_t>>(0);
 
-		auto iter = logins.find(from);
+		jobs->reserve(names.size());
 
-		if (iter == logins.end())
+		for (const auto &name : names)
 		{
-			return false;
+			if (name.empty() || restricted_dbs.contains(name) || dbt.contains(name) || loading.contains(name))
+			{
+				continue;
+			}
+
+			// the db is constructed in place so it never has to be moved once its files are open
+			auto [iter, _] = loading.try_emplace(name, name);
+
+			Job &job = jobs->emplace_back(Job{ &iter->second.db });
+
+			pending.emplace(name, job.done.get_future().share());
+		}
+
+		if (jobs->empty())
+		{
+			return;
+		}
+
+		if (threads == 0)
+		{
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		threads = std::min(threads, jobs->size());
+
+		for (size_t i = 0; i < threads; i++)
+		{
+			loaders.emplace_back([this, jobs, next]
+			{
+				size_t n;
+
+				while ((n = next->fetch_add(1)) < jobs->size())
+				{
+					Job &job = (*jobs)[n];
+
+					auto res = job.db->open();
+
+					// counted first so a command that sees the result ready always finds it counted
+					loaded++;
+					job.done.set_value(res);
+				}
+			});
+		}
+	}
+
+	void Interpreter::collect_preloaded()
+	{
+		for (auto iter = pending.begin(); iter != pending.end();)
+		{
+			auto &[db_name, future] = *iter;
+
+			if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				iter++;
+				continue;
+			}
+
+			auto node = loading.extract(db_name);
+
+			if (future.get().ok())
+			{
+				dbt.insert(std::move(node));
+			}
+
+			iter = pending.erase(iter);
+			loaded--;
 		}
+	}
+
+	FlagT Interpreter::load_perms(Login &login)
+	{
+		FlagT perms;
 
-		auto opt = users.get(iter->second.name);
+		login.roles.clear();
 
+		auto opt = users.get(login.name);
+
+		// the user was deleted
 		if (!opt)
 		{
-			return false;
+			return perms;
 		}
 
 		std::string &data = opt.value();
 
 		size_t offset = data[0]+1;
 
-		int must_satisfy = needed.count();
-		int satisfied = 0;
-
 		while (offset < data.size())
 		{
 			std::string_view role_name = get_field(data, offset);
 			offset += role_name.size()+1;
 
-			auto opt = roles.get(std::string{role_name});
+			// roles that do not exist are kept in case they are created later
+			std::string &role = login.roles.emplace_back(role_name);
 
-			if (!opt)
+			auto opt = roles.get(role);
+
+			if (opt)
 			{
-				continue;
+				perms |= from_str(opt.value());
 			}
+		}
 
-			FlagT flag = from_str(opt.value());
+		return perms;
+	}
 
-			for (auto [_, perm] : perm_table)
+	void Interpreter::refresh_user(std::string_view name)
+	{
+		for_each_session([&](Session &session)
+		{
+			if (session.login && session.login->name == name)
 			{
-				if (needed.test(perm) && flag.test(perm))
-				{
-					satisfied++;
-					needed.flip(perm);
-				}
+				session.granted = load_perms(*session.login);
 			}
-		}
+		});
+	}
+
+	void Interpreter::refresh_role(std::string_view role)
+	{
+		for_each_session([&](Session &session)
+		{
+			auto &login = session.login;
 
-		return satisfied >= must_satisfy;
+			if (login && std::find(login->roles.begin(), login->roles.end(), role) != login->roles.end())
+			{
+				session.granted = load_perms(*login);
+			}
+		});
 	}
 
-	Result Interpreter::interpret(Cmd &cmd, int from)
+	Result Interpreter::interpret(Cmd &cmd, Session &session)
 	{
-		auto iter = ct.find(cmd.cmd);
+		// a busy table is left alone, the next command that finds it free collects instead
+		if (loaded.load(std::memory_order_acquire))
+		{
+			std::unique_lock lock(dbs_mutex, std::try_to_lock);
 
-		if (iter == ct.end())
+			if (lock)
+			{
+				collect_preloaded();
+			}
+		}
+
+		CmdHandle *handle = cmd.opcode < by_opcode.size() ? by_opcode[cmd.opcode] : find_command(cmd.cmd);
+
+		if (!handle)
 		{
 			return INTER_ERR("command does not exist");
 		}
 
-		auto &[_, ch] = *iter;
+		CmdHandle &ch = *handle;
 
 		if (ch.arity != -1 && cmd.args.size() < ch.arity)
 		{
 			return INTER_ERR("Not enough arguments to command");
 		}
 
-		ambry::DB **wdb = get_wdb(from);
+		if ((session.perms() & ch.perms) != ch.perms)
+		{
+			return INTER_ERR("you do not meet the permissions to execute this command");
+		}
+
+		std::shared_lock read_dbs(dbs_mutex, std::defer_lock);
+		std::unique_lock write_dbs(dbs_mutex, std::defer_lock);
+		std::shared_lock read_accounts(accounts_mutex, std::defer_lock);
+		std::unique_lock write_accounts(accounts_mutex, std::defer_lock);
+
+		switch (ch.access)
+		{
+			case Access::Everything:
+				write_dbs.lock();
+				write_accounts.lock();
+				break;
+			case Access::ReadDB:
+			case Access::WriteDB:
+			case Access::ReadTable:
+				read_dbs.lock();
+				break;
+			case Access::WriteTable:
+				write_dbs.lock();
+				break;
+			case Access::ReadAccounts:
+				read_accounts.lock();
+				break;
+			case Access::WriteAccounts:
+				write_accounts.lock();
+				break;
+			case Access::Session:
+				break;
+		}
+
+		// a session without a login never has a working db. it can only be looked at while the table is held
+		OpenDB *open = read_dbs || write_dbs ? session.wdb : nullptr;
 
-		if (ch.expect_wdb && (wdb && !(*wdb)))
+		if (ch.expect_wdb && !open)
 		{
 			return INTER_ERR("expected an open database but none found");
 		}
 
+		std::shared_lock<std::shared_mutex> read_db;
+		std::unique_lock<std::shared_mutex> write_db;
+
+		if (open && ch.access == Access::ReadDB)
+		{
+			read_db = std::shared_lock(open->mutex);
+		}
+		else if (open && ch.access == Access::WriteDB)
+		{
+			write_db = std::unique_lock(open->mutex);
+		}
+
 		Ctx ctx
 		{
 			*this,
 			cmd,
-			from,
-			*wdb
+			session,
+			open ? &open->db : nullptr
 		};
 
-		if (!calculate_perms(from, ch.perms))
+		auto start = std::chrono::steady_clock::now();
+
+		Result result = ch.fn(ctx);
+
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		ch.latency->record(ns);
+
+		if (ns >= slowlog_threshold)
 		{
-			return INTER_ERR("you do not meet the permissions to execute this command");
+			log_slow(cmd, ch, session, ns);
+		}
+
+		return result;
+	}
+
+	// how much of a command the slow log keeps
+	constexpr size_t SLOWLOG_ARGS = 4;
+	constexpr size_t SLOWLOG_ARG_SIZE = 32;
+
+	void Interpreter::log_slow(const Cmd &cmd, const CmdHandle &handle, const Session &session, uint64_t ns)
+	{
+		SlowEntry entry
+		{
+			.time = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count(),
+			.ns = ns,
+			.command = std::string(cmd.cmd),
+		};
+
+		// binary commands are named by their opcode
+		if (cmd.opcode < std::size(opcodes))
+		{
+			entry.command = opcodes[cmd.opcode];
+		}
+
+		size_t shown = handle.secret_args ? 0 : std::min(cmd.args.size(), SLOWLOG_ARGS);
+
+		for (size_t i = 0; i < shown; i++)
+		{
+			if (i)
+			{
+				entry.args += ' ';
+			}
+
+			for (char c : cmd.args[i].substr(0, SLOWLOG_ARG_SIZE))
+			{
+				entry.args += std::isprint((unsigned char)c) ? c : '?';
+			}
+
+			if (cmd.args[i].size() > SLOWLOG_ARG_SIZE)
+			{
+				entry.args += "...";
+			}
+		}
+
+		if (cmd.args.size() > shown)
+		{
+			entry.args += (shown ? " (" : "(") + std::to_string(cmd.args.size() - shown) + " more)";
+		}
+
+		// the command may have logged in or out so this is the login it ended with
+		entry.user = session.login ? session.login->name : "";
+
+		std::lock_guard lock(slowlog_mutex);
+
+		if (slowlog_max == 0)
+		{
+			return;
 		}
 
-		return ch.fn(ctx);
+		entry.id = slowlog_next_id++;
+
+		slowlog.push_front(std::move(entry));
+
+		while (slowlog.size() > slowlog_max)
+		{
+			slowlog.pop_back();
+		}
 	}
 
 	struct ParserCtx
@@ -994,35 +2221,55 @@ set:
 		}
 	}
 
-	std::string parse_quoted(ParserCtx &ctx)
+	// quoted args are only copied when they have escapes in them, otherwise they view the source
+	std::string_view parse_quoted(ParserCtx &ctx, std::deque<std::string> &unescaped)
 	{
-		++ctx.pos;
+		size_t start = ++ctx.pos;
 
-		std::string buff;
-
-		buff.reserve(ctx.str.size()-ctx.pos);
+		bool escaped = false;
 
 		while (!ctx.at_end() && ctx.peek() != '"')
 		{
-			char c = ctx.peek();
-
-			if (c == '\\' && ctx.pos+2 < ctx.str.size())
+			if (ctx.peek() == '\\' && ctx.pos+2 < ctx.str.size())
 			{
+				escaped = true;
 				ctx.pos++;
-				c = escape(ctx.peek());
 			}
 
-			buff += c;
-
 			ctx.pos++;
 		}
 
+		std::string_view raw = ctx.str.substr(start, ctx.pos-start);
+
 		ctx.pos++;
 
+		if (!escaped)
+		{
+			return raw;
+		}
+
+		std::string &buff = unescaped.emplace_back();
+
+		buff.reserve(raw.size());
+
+		size_t left = ctx.str.size()-start;
+
+		for (size_t i = 0; i < raw.size(); i++)
+		{
+			char c = raw[i];
+
+			if (c == '\\' && i+2 < left)
+			{
+				c = escape(raw[++i]);
+			}
+
+			buff += c;
+		}
+
 		return buff;
 	}
 
-	std::optional<std::string> parse_arg(ParserCtx &ctx)
+	std::optional<std::string_view> parse_arg(ParserCtx &ctx, std::deque<std::string> &unescaped)
 	{
 		bool at_end = ctx.advance_if([&]{ return ctx.is_unimportant(); });
 
@@ -1033,50 +2280,169 @@ set:
 
 		if (ctx.peek() == '"')
 		{
-			return parse_quoted(ctx);
+			return parse_quoted(ctx, unescaped);
 		}
 
 		size_t start = ctx.pos;
 
 		ctx.advance_if([&]{ return !ctx.is_unimportant(); });
 
-		return std::string{ ctx.str.substr(start, ctx.pos-start) };
+		return ctx.str.substr(start, ctx.pos-start);
+	}
+
+	void Commands::clear()
+	{
+		m_size = 0;
+		m_unescaped.clear();
+	}
+
+	Cmd &Commands::next()
+	{
+		if (m_size == m_cmds.size())
+		{
+			m_cmds.emplace_back();
+		}
+
+		Cmd &cmd = m_cmds[m_size++];
+
+		cmd.opcode = NAMED_OPCODE;
+		cmd.args.clear();
+
+		return cmd;
 	}
 
-	std::vector<Cmd> parse(std::string_view source)
+	bool parse(std::string_view source, Commands &out)
 	{
-		std::vector<Cmd> output;
+		out.clear();
 
 		ParserCtx ctx(source);
 
 		while (!ctx.at_end())
 		{
-			Cmd cmd;
-
-			auto opt = parse_arg(ctx);
+			auto opt = parse_arg(ctx, out.m_unescaped);
 
+			// only trailing whitespace is left
 			if (!opt)
 			{
-				return {};
+				break;
 			}
 
-			cmd.cmd = std::move(opt.value());
+			Cmd &cmd = out.next();
+
+			cmd.cmd = opt.value();
 
 			while (!ctx.at_end() && ctx.peek() != '\n')
 			{
-				auto arg = parse_arg(ctx);
+				auto arg = parse_arg(ctx, out.m_unescaped);
 
 				if (!arg)
 				{
 					break;
 				}
 
-				cmd.args.push_back(std::move(arg.value()));
+				cmd.args.push_back(arg.value());
 			}
-
-			output.push_back(std::move(cmd));
 		}
 
+		return !out.empty();
+	}
+
+	Commands parse(std::string_view source)
+	{
+		Commands output;
+
+		parse(source, output);
+
 		return output;
 	}
+
+	template<class T>
+	bool take_int(std::string_view &source, T &out)
+	{
+		if (source.size() < sizeof(T))
+		{
+			return false;
+		}
+
+		memcpy(&out, source.data(), sizeof(T));
+
+		source.remove_prefix(sizeof(T));
+
+		return true;
+	}
+
+	bool parse_binary(std::string_view source, Commands &out)
+	{
+		out.clear();
+
+		while (!source.empty())
+		{
+			uint8_t opcode;
+			uint16_t argc;
+
+			if (!take_int(source, opcode) || !take_int(source, argc))
+			{
+				out.clear();
+				return false;
+			}
+
+			if (opcode != NAMED_OPCODE && opcode >= std::size(opcodes))
+			{
+				out.clear();
+				return false;
+			}
+
+			Cmd &cmd = out.next();
+
+			cmd.opcode = opcode;
+
+			for (uint16_t i = 0; i < argc; i++)
+			{
+				uint32_t len;
+
+				if (!take_int(source, len) || len > source.size())
+				{
+					out.clear();
+					return false;
+				}
+
+				cmd.args.push_back(source.substr(0, len));
+
+				source.remove_prefix(len);
+			}
+
+			if (opcode != NAMED_OPCODE)
+			{
+				cmd.cmd = opcodes[opcode];
+				continue;
+			}
+
+			if (cmd.args.empty())
+			{
+				out.clear();
+				return false;
+			}
+
+			cmd.cmd = cmd.args.front();
+			cmd.args.erase(cmd.args.begin());
+		}
+
+		return !out.empty();
+	}
+
+	void encode_binary(std::string &out, uint8_t opcode, std::initializer_list<std::string_view> args)
+	{
+		uint16_t argc = args.size();
+
+		out += (char)opcode;
+		out.append((char*)&argc, sizeof(argc));
+
+		for (auto arg : args)
+		{
+			uint32_t len = arg.size();
+
+			out.append((char*)&len, sizeof(len));
+			out += arg;
+		}
+	}
 }
\ No newline at end of file
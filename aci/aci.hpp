@@ -2,7 +2,12 @@
 
 #include "../lib/types.hpp"
 #include "../lib/db.hpp"
+#include "expr.hpp"
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <initializer_list>
 #include <limits>
 #include <optional>
 #include <string>
@@ -11,7 +16,12 @@
 #include <unordered_map>
 #include <variant>
 #include <set>
+#include <unordered_set>
 #include <bitset>
+#include <future>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 // ambry command interpreter 
 
@@ -63,26 +73,128 @@ namespace aci
 
 	#undef SETF
 
+	/*
+		the opcode of a default command in the binary protocol is its index in this list.
+		commands are only ever added to the end so existing opcodes never change
+	*/
+	constexpr std::string_view opcodes[]
+	{
+		"create_user", "working_db", "show_users", "user_roles", "active_users", "show_roles",
+		"delete_role", "create_role", "delete_user", "login", "logout", "add_roles", "remove_roles",
+		"open", "close", "switch", "cache_mode", "set", "update", "get", "erase", "incr", "decr",
+		"append", "cas", "close_all", "destroy", "destroy_all", "cmds", "list_open", "protocol",
+		"when", "scan", "mget", "mset", "mdel", "latency", "slowlog", "stats",
+	};
+
+	// a binary command with this opcode names its command in the first argument. its also the opcode of text commands
+	constexpr uint8_t NAMED_OPCODE = 0xff;
+
+	// returns the opcode of a default command
+	std::optional<uint8_t> opcode_of(std::string_view name);
+
+	enum class Protocol : uint8_t
+	{
+		Text,
+		Binary,
+	};
+
 	struct Cmd
 	{
-		std::string cmd;
-		std::vector<std::string> args;
+		// commands from the binary protocol are found by their opcode without looking up the name
+		uint8_t opcode = NAMED_OPCODE;
+		std::string_view cmd;
+		// views into the parsed source or into the unescaped strings of the Commands holding it
+		std::vector<std::string_view> args;
+	};
+
+	/*
+		the commands parsed out of one message. they point into the message so it has to outlive them.
+		parsing into the same Commands again reuses the memory of the previous message
+	*/
+	class Commands
+	{
+	public:
+		inline std::vector<Cmd>::iterator begin()
+		{
+			return m_cmds.begin();
+		}
+
+		inline std::vector<Cmd>::iterator end()
+		{
+			return m_cmds.begin() + m_size;
+		}
+
+		inline Cmd &operator[](size_t index)
+		{
+			return m_cmds[index];
+		}
+
+		inline size_t size() const
+		{
+			return m_size;
+		}
+
+		inline bool empty() const
+		{
+			return m_size == 0;
+		}
+
+	private:
+		friend bool parse(std::string_view source, Commands &out);
+		friend bool parse_binary(std::string_view source, Commands &out);
+
+		std::vector<Cmd> m_cmds;
+		size_t m_size = 0;
+		// quoted args that had escapes in them. a deque so adding one never moves the others
+		std::deque<std::string> m_unescaped;
+
+		void clear();
+
+		// commands from earlier messages are reused so their args keep their capacity
+		Cmd &next();
 	};
 
 	class Interpreter;
 
 	using Result = ambry::BasicResult<std::string>;
 
+	struct Session;
+
 	struct Ctx
 	{
 		Interpreter &inter;
 		Cmd &cmd;
-		int fd;
-		ambry::DB *&wdb;
+		Session &session;
+		// the working db of the session. commands that change it set session.wdb
+		ambry::DB *wdb;
 	};
 
 	typedef Result(*CmdFN)(Ctx&);
 
+	/*
+		what a command touches besides its own session. commands only hold the locks they need so commands on
+		different databases, or reading the same one, run at the same time
+	*/
+	enum class Access : uint8_t
+	{
+		// holds every lock exclusively. the default so a command added later is safe before it says what it touches
+		Everything,
+		// nothing shared, or the command takes the locks it needs itself
+		Session,
+		// reads the working db
+		ReadDB,
+		// changes the working db. only commands on other databases run alongside it
+		WriteDB,
+		// reads the table of open databases or picks a working db from it
+		ReadTable,
+		// opens, closes or destroys databases
+		WriteTable,
+		// reads users and roles
+		ReadAccounts,
+		// changes users and roles
+		WriteAccounts,
+	};
+
 	struct CmdHandle
 	{
 		int arity;
@@ -92,17 +204,85 @@ namespace aci
 		// if true well expect their to be a wdb set
 		bool expect_wdb = true;
 		FlagT perms = 0;
+		// what the command touches, which decides the locks it holds while it runs
+		Access access = Access::Everything;
+		// keeps the args out of the slow log. set for commands that take a password
+		bool secret_args = false;
+		// how long the command takes to run in nanoseconds. shared so copies of a handle record to the same place
+		std::shared_ptr<ambry::Histogram> latency = std::make_shared<ambry::Histogram>();
+	};
+
+	// lets maps keyed by std::string be searched with a string_view without making a string
+	struct StringHash
+	{
+		using is_transparent = void;
+
+		inline size_t operator()(std::string_view str) const
+		{
+			return std::hash<std::string_view>{}(str);
+		}
 	};
 
 	using CmdTable = std::unordered_map<std::string_view, CmdHandle>;
-	using DBTable  = std::unordered_map<std::string, ambry::DB>;
+
+	// an open database and the lock commands using it hold
+	struct OpenDB
+	{
+		ambry::DB db;
+		// held shared by commands reading the db and exclusively by commands changing it
+		std::shared_mutex mutex;
+
+		OpenDB(std::string_view name) :
+			db(name)
+		{}
+	};
+
+	using DBTable  = std::unordered_map<std::string, OpenDB>;
 
 	struct Login
 	{
 		std::string name;
-		ambry::DB *wdb;
+		std::vector<std::string> roles;
+	};
+
+	/*
+		the state of a single connection, owned by whatever serves the connection and passed to every command it runs.
+		other threads only touch a session while walking the registered sessions: they clear the working db while
+		holding the database table exclusively and reload the permissions while holding the accounts exclusively
+	*/
+	struct Session
+	{
+		// only set and reset while holding sessions_mutex so walks see a whole login
+		std::optional<Login> login;
+		// only read or written while holding the database table
+		OpenDB *wdb = nullptr;
+		Protocol protocol = Protocol::Text;
+
+		// every permission the users roles grant. worked out at login and whenever the roles change
+		std::atomic<FlagT> granted{};
+
+		inline FlagT perms() const
+		{
+			return granted.load(std::memory_order_relaxed);
+		}
+	};
+
+	// a command that took at least the slow log threshold to run
+	struct SlowEntry
+	{
+		uint64_t id;
+		// unix time in seconds of when the command finished
+		int64_t time;
+		uint64_t ns;
+		std::string command;
+		// the first few args shortened and with unprintable bytes replaced
+		std::string args;
+		std::string user;
 	};
 
+	// the name and value pairs reported by the stats command
+	using StatFields = std::vector<std::pair<std::string, std::string>>;
+
 	template<class ...A>
 	constexpr FlagT set_perms(A ...a)
 	{
@@ -127,18 +307,55 @@ namespace aci
 		std::set<std::string_view> restricted_dbs;
 
 		// useful for quit commands
-		bool running = true;
-
-		std::unordered_map<int, Login> logins;
+		std::atomic<bool> running = true;
+
+		/*
+			the locks commands take, in the order they are taken. dbs_mutex guards dbt and the preloads, held shared by
+			commands using a database so it can not be closed under them. a database's own mutex is taken after it.
+			accounts_mutex guards users and roles. sessions_mutex is always taken last
+		*/
+		std::shared_mutex dbs_mutex;
+		std::shared_mutex accounts_mutex;
+
+		// every session that has been started. only walked by the few commands that look at other sessions
+		std::unordered_set<Session*> sessions;
+		std::mutex sessions_mutex;
+
+		// compiled expressions by their source. cleared once it holds MAX_PROGRAMS
+		std::unordered_map<std::string, std::shared_ptr<const expr::Program>, StringHash, std::equal_to<>> programs;
+		std::mutex programs_mutex;
+
+		static constexpr size_t MAX_PROGRAMS = 1024;
+
+		// the newest entry is at the front. it never holds more than slowlog_max entries
+		std::deque<SlowEntry> slowlog;
+		std::atomic<uint64_t> slowlog_threshold = 10'000'000;
+		size_t slowlog_max = 128;
+		uint64_t slowlog_next_id = 0;
+		// guards the slow log as it is added to by read only commands too
+		std::mutex slowlog_mutex;
+
+		// adds the fields of whatever owns the connections to the stats command
+		std::function<void(StatFields&)> server_stats;
+
+		// databases that are still being opened by preload or open. they are moved into dbt once loaded
+		DBTable loading;
+		std::unordered_map<std::string, std::shared_future<ambry::Result>> pending;
+		std::vector<std::thread> loaders;
+		// loads that have finished but are not in dbt yet so commands only try to collect when there is something to collect
+		std::atomic<size_t> loaded = 0;
 
 		Interpreter(DBTable &dbt) :
 			dbt(dbt),
 			users("__ACI_USERS__", {.enable_cache = true}),
 			roles("__ACI_ROLES__", {.enable_cache = true})
 		{
-			users.open();
+			std::thread user_loader([&]{ users.open(); });
+
 			roles.open();
 
+			user_loader.join();
+
 			restricted_dbs.emplace("__ACI_USERS__");
 			restricted_dbs.emplace("__ACI_ROLES__");
 
@@ -147,14 +364,79 @@ namespace aci
 			roles.set("admin", {(char*)&admin_int, sizeof(admin_int)});
 		}
 
+		~Interpreter();
+
 		void init_commands();
 
-		Result interpret(Cmd &cmd, int from);
+		// opens the given databases in the background on up to n threads (0 uses all cores)
+		void preload(const std::vector<std::string> &names, size_t threads = 0);
+
+		// moves finished loads into dbt without waiting on the others. dbs_mutex must be held exclusively
+		void collect_preloaded();
+
+		// the default commands indexed by the perfect hash of their name and by their opcode. filled by compile_commands
+		std::vector<CmdHandle*> builtins;
+		std::vector<CmdHandle*> by_opcode;
+
+		/*
+			resolves the default commands in ct ahead of time. init_commands calls it, it only needs to be
+			called again if a default command is erased from ct. commands added to ct are still found without it
+		*/
+		void compile_commands();
+
+		CmdHandle *find_command(std::string_view name);
 
-		bool calculate_perms(int from, FlagT needed);
+		// makes a session visible to the commands that look at every session. it must not move until end_session
+		void start_session(Session &session);
+
+		// forgets a session. no command for it can be running
+		void end_session(Session &session);
+
+		// calls fn with every session
+		template<class F>
+		void for_each_session(F &&fn)
+		{
+			std::lock_guard lock(sessions_mutex);
+
+			for (Session *session : sessions)
+			{
+				fn(*session);
+			}
+		}
 
-		ambry::DB** get_wdb(int from);
+		// clears the working db of every session using db, or of every session if db is null. dbs_mutex must be held exclusively
+		void forget_db(const OpenDB *db);
+
+		// compiles an expression or returns the cached program. sets error if it does not compile
+		std::shared_ptr<const expr::Program> compile(std::string_view source, std::string &error);
+
+		// runs a command for a session, recording how long it took and adding it to the slow log if it was slow
+		Result interpret(Cmd &cmd, Session &session);
+
+		void log_slow(const Cmd &cmd, const CmdHandle &handle, const Session &session, uint64_t ns);
+
+		// reads the roles of a login and works out its permissions
+		FlagT load_perms(Login &login);
+
+		// reloads the permissions of every login of a user
+		void refresh_user(std::string_view name);
+
+		// reloads the permissions of every login with the given role
+		void refresh_role(std::string_view role);
 	};
 
-	std::vector<Cmd> parse(std::string_view source);
+	// parses newline separated commands into out. returns false and leaves out empty if the source has no command
+	bool parse(std::string_view source, Commands &out);
+
+	Commands parse(std::string_view source);
+
+	/*
+		parses a message of the binary protocol. a message holds any number of commands encoded as
+		[u8 opcode][u16 arg count] then [u32 length][bytes] for every arg, with lengths in the machines byte order.
+		args view the source and are never copied. returns false and leaves out empty if the message is malformed
+	*/
+	bool parse_binary(std::string_view source, Commands &out);
+
+	// appends a command in the binary protocol to out
+	void encode_binary(std::string &out, uint8_t opcode, std::initializer_list<std::string_view> args);
 }
\ No newline at end of file
@@ -0,0 +1,895 @@
+#include "expr.hpp"
+#include "../lib/asf_view.hpp"
+#include "../shared/fmt.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <limits>
+
+namespace aci::expr
+{
+	struct Compiler
+	{
+		std::string_view src;
+		std::string &error;
+
+		Program program;
+
+		size_t pos = 0;
+		size_t depth = 0;
+		size_t stack = 0;
+
+		bool fail(std::string_view message)
+		{
+			if (error.empty())
+			{
+				error = fmt::format("{} at {}", message, pos);
+			}
+
+			return false;
+		}
+
+		void skip_space()
+		{
+			while (pos < src.size() && (src[pos] == ' ' || src[pos] == '\t' || src[pos] == '\n' || src[pos] == '\r'))
+			{
+				pos++;
+			}
+		}
+
+		bool accept(std::string_view token)
+		{
+			skip_space();
+
+			if (src.substr(pos).starts_with(token))
+			{
+				pos += token.size();
+				return true;
+			}
+
+			return false;
+		}
+
+		// keeps track of how deep the stack gets as code is emitted
+		void emit(Op op, uint32_t arg = 0)
+		{
+			switch (op)
+			{
+				case Op::Push:
+				case Op::PushString:
+				case Op::Field:
+				case Op::Value:
+				case Op::Exists:
+					stack++;
+					break;
+				case Op::Not:
+				case Op::Neg:
+				case Op::JumpIfFalseOrPop:
+				case Op::JumpIfTrueOrPop:
+					break;
+				default:
+					stack--;
+					break;
+			}
+
+			program.stack_size = std::max(program.stack_size, stack);
+			program.code.push_back({ op, arg });
+		}
+
+		// a && b and a || b only run b if a did not decide the result
+		template<class FN>
+		bool short_circuit(Op jump, FN operand)
+		{
+			size_t at = program.code.size();
+
+			emit(jump);
+
+			// the left side is popped when the right side runs
+			stack--;
+
+			if (!operand())
+			{
+				return false;
+			}
+
+			program.code[at].arg = program.code.size();
+
+			return true;
+		}
+
+		bool expression()
+		{
+			if (!conjunction())
+			{
+				return false;
+			}
+
+			while (accept("||"))
+			{
+				if (!short_circuit(Op::JumpIfTrueOrPop, [&]{ return conjunction(); }))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool conjunction()
+		{
+			if (!comparison())
+			{
+				return false;
+			}
+
+			while (accept("&&"))
+			{
+				if (!short_circuit(Op::JumpIfFalseOrPop, [&]{ return comparison(); }))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool comparison()
+		{
+			if (!sum())
+			{
+				return false;
+			}
+
+			// the two character operators have to be tried first
+			constexpr std::pair<std::string_view, Op> ops[]
+			{
+				{ "==", Op::Eq }, { "!=", Op::Ne }, { "<=", Op::Le }, { ">=", Op::Ge }, { "<", Op::Lt }, { ">", Op::Gt },
+			};
+
+			for (auto [token, op] : ops)
+			{
+				if (accept(token))
+				{
+					if (!sum())
+					{
+						return false;
+					}
+
+					emit(op);
+
+					return true;
+				}
+			}
+
+			return true;
+		}
+
+		bool sum()
+		{
+			if (!product())
+			{
+				return false;
+			}
+
+			while (true)
+			{
+				Op op;
+
+				if (accept("+"))
+					op = Op::Add;
+				else if (accept("-"))
+					op = Op::Sub;
+				else
+					return true;
+
+				if (!product())
+				{
+					return false;
+				}
+
+				emit(op);
+			}
+		}
+
+		bool product()
+		{
+			if (!unary())
+			{
+				return false;
+			}
+
+			while (true)
+			{
+				Op op;
+
+				if (accept("*"))
+					op = Op::Mul;
+				else if (accept("/"))
+					op = Op::Div;
+				else if (accept("%"))
+					op = Op::Mod;
+				else
+					return true;
+
+				if (!unary())
+				{
+					return false;
+				}
+
+				emit(op);
+			}
+		}
+
+		bool unary()
+		{
+			if (++depth > MAX_DEPTH)
+			{
+				return fail("expression is nested too deeply");
+			}
+
+			bool ok;
+
+			if (accept("!"))
+			{
+				ok = unary();
+				emit(Op::Not);
+			}
+			else if (accept("-"))
+			{
+				ok = unary();
+				emit(Op::Neg);
+			}
+			else
+			{
+				ok = primary();
+			}
+
+			depth--;
+
+			return ok;
+		}
+
+		bool string()
+		{
+			std::string str;
+
+			pos++;
+
+			while (pos < src.size() && src[pos] != '"')
+			{
+				if (src[pos] == '\\' && pos+1 < src.size())
+				{
+					pos++;
+				}
+
+				str += src[pos++];
+			}
+
+			if (pos == src.size())
+			{
+				return fail("unterminated string");
+			}
+
+			pos++;
+
+			program.strings.push_back(std::move(str));
+
+			emit(Op::PushString, program.strings.size()-1);
+
+			return true;
+		}
+
+		bool number()
+		{
+			const char *start = src.data() + pos;
+			const char *end = src.data() + src.size();
+
+			int64_t n;
+
+			auto [int_end, int_ec] = std::from_chars(start, end, n);
+
+			// anything that does not stop at the end of an integer is read as a double
+			if (int_ec == std::errc() && (int_end == end || !std::strchr(".eE", *int_end)))
+			{
+				pos += int_end - start;
+				program.constants.push_back(n);
+				emit(Op::Push, program.constants.size()-1);
+				return true;
+			}
+
+			double d;
+
+			auto [double_end, double_ec] = std::from_chars(start, end, d);
+
+			if (double_ec != std::errc())
+			{
+				return fail("invalid number");
+			}
+
+			pos += double_end - start;
+			program.constants.push_back(d);
+			emit(Op::Push, program.constants.size()-1);
+
+			return true;
+		}
+
+		static bool is_name_char(char c)
+		{
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+		}
+
+		std::string_view name()
+		{
+			size_t start = pos;
+
+			while (pos < src.size() && is_name_char(src[pos]))
+			{
+				pos++;
+			}
+
+			return src.substr(start, pos-start);
+		}
+
+		// keys with other characters in them can be quoted like $"some key"
+		std::string_view key()
+		{
+			if (pos == src.size() || src[pos] != '"')
+			{
+				return name();
+			}
+
+			size_t start = ++pos;
+			size_t end = src.find('"', start);
+
+			if (end == std::string_view::npos)
+			{
+				pos = src.size();
+				return {};
+			}
+
+			pos = end+1;
+
+			return src.substr(start, end-start);
+		}
+
+		bool field()
+		{
+			std::vector<std::string> path;
+
+			do
+			{
+				pos++;
+
+				std::string_view key = this->key();
+
+				if (key.empty())
+				{
+					return fail("expected a field name");
+				}
+
+				path.emplace_back(key);
+			}
+			while (pos < src.size() && src[pos] == '.');
+
+			program.paths.push_back(std::move(path));
+
+			emit(Op::Field, program.paths.size()-1);
+
+			return true;
+		}
+
+		bool primary()
+		{
+			skip_space();
+
+			if (pos == src.size())
+			{
+				return fail("expected a value");
+			}
+
+			char c = src[pos];
+
+			if (c == '(')
+			{
+				pos++;
+
+				if (!expression())
+				{
+					return false;
+				}
+
+				if (!accept(")"))
+				{
+					return fail("expected )");
+				}
+
+				return true;
+			}
+
+			if (c == '"')
+			{
+				return string();
+			}
+
+			if (c == '$')
+			{
+				return field();
+			}
+
+			if ((c >= '0' && c <= '9') || c == '.')
+			{
+				return number();
+			}
+
+			std::string_view word = name();
+
+			if (word == "true" || word == "false")
+			{
+				program.constants.push_back(word == "true");
+				emit(Op::Push, program.constants.size()-1);
+			}
+			else if (word == "null")
+			{
+				program.constants.push_back(std::monostate());
+				emit(Op::Push, program.constants.size()-1);
+			}
+			else if (word == "value")
+			{
+				emit(Op::Value);
+			}
+			else if (word == "exists")
+			{
+				emit(Op::Exists);
+			}
+			else
+			{
+				return fail("unknown name");
+			}
+
+			return true;
+		}
+	};
+
+	std::optional<Program> compile(std::string_view source, std::string &error)
+	{
+		if (source.size() > MAX_SOURCE)
+		{
+			error = "expression is too long";
+			return std::nullopt;
+		}
+
+		Compiler compiler { source, error };
+
+		if (!compiler.expression())
+		{
+			return std::nullopt;
+		}
+
+		compiler.skip_space();
+
+		if (compiler.pos != source.size())
+		{
+			compiler.fail("unexpected input");
+			return std::nullopt;
+		}
+
+		return std::move(compiler.program);
+	}
+
+	bool truthy(const Scalar &s)
+	{
+		return std::visit([](const auto &v) -> bool
+		{
+			using T = std::decay_t<decltype(v)>;
+
+			if constexpr (std::is_same_v<T, std::monostate>)
+				return false;
+			else if constexpr (std::is_same_v<T, std::string_view>)
+				return !v.empty();
+			else
+				return v != 0;
+		}, s);
+	}
+
+	// reads the whole value as a number if it is one
+	Scalar read_value(std::string_view value)
+	{
+		const char *end = value.data() + value.size();
+
+		int64_t n;
+
+		auto [int_end, int_ec] = std::from_chars(value.data(), end, n);
+
+		if (!value.empty() && int_ec == std::errc() && int_end == end)
+		{
+			return n;
+		}
+
+		double d;
+
+		auto [double_end, double_ec] = std::from_chars(value.data(), end, d);
+
+		if (!value.empty() && double_ec == std::errc() && double_end == end)
+		{
+			return d;
+		}
+
+		return value;
+	}
+
+	std::optional<Scalar> read_field(const ambry::View &view)
+	{
+		switch (view.type())
+		{
+			case ambry::U64:
+			{
+				auto n = view.get<uint64_t>();
+
+				if (!n)
+				{
+					return std::nullopt;
+				}
+
+				if (*n > uint64_t(std::numeric_limits<int64_t>::max()))
+				{
+					return double(*n);
+				}
+
+				return int64_t(*n);
+			}
+			case ambry::Double:
+			{
+				auto d = view.get<double>();
+
+				if (!d)
+				{
+					return std::nullopt;
+				}
+
+				return *d;
+			}
+			case ambry::StringT:
+			{
+				auto str = view.string();
+
+				if (!str)
+				{
+					return std::nullopt;
+				}
+
+				return *str;
+			}
+			default:
+			{
+				auto n = view.integer();
+
+				if (!n)
+				{
+					return std::nullopt;
+				}
+
+				return *n;
+			}
+		}
+	}
+
+	bool is_number(const Scalar &s)
+	{
+		return s.index() == 2 || s.index() == 3;
+	}
+
+	double as_double(const Scalar &s)
+	{
+		return s.index() == 2 ? double(std::get<int64_t>(s)) : std::get<double>(s);
+	}
+
+	// the result of an arithmetic op or the error it ran into
+	struct Arith
+	{
+		Scalar value;
+		std::string_view error;
+	};
+
+	Arith arithmetic(Op op, const Scalar &a, const Scalar &b)
+	{
+		if (!is_number(a) || !is_number(b))
+		{
+			return { {}, "arithmetic needs numbers" };
+		}
+
+		if (op == Op::Mod)
+		{
+			if (a.index() != 2 || b.index() != 2)
+			{
+				return { {}, "% needs integers" };
+			}
+
+			int64_t x = std::get<int64_t>(a);
+			int64_t y = std::get<int64_t>(b);
+
+			if (y == 0 || (x == std::numeric_limits<int64_t>::min() && y == -1))
+			{
+				return { {}, "invalid modulo" };
+			}
+
+			return { x % y };
+		}
+
+		// division always gives a double so 1 / 2 is not 0
+		if (op == Op::Div)
+		{
+			double y = as_double(b);
+
+			if (y == 0)
+			{
+				return { {}, "division by zero" };
+			}
+
+			return { as_double(a) / y };
+		}
+
+		if (a.index() == 2 && b.index() == 2)
+		{
+			int64_t x = std::get<int64_t>(a);
+			int64_t y = std::get<int64_t>(b);
+			int64_t out;
+
+			bool overflow =
+				op == Op::Add ? __builtin_add_overflow(x, y, &out) :
+				op == Op::Sub ? __builtin_sub_overflow(x, y, &out) :
+				__builtin_mul_overflow(x, y, &out);
+
+			if (overflow)
+			{
+				return { {}, "integer overflow" };
+			}
+
+			return { out };
+		}
+
+		double x = as_double(a);
+		double y = as_double(b);
+
+		return { op == Op::Add ? x + y : op == Op::Sub ? x - y : x * y };
+	}
+
+	bool equal(const Scalar &a, const Scalar &b)
+	{
+		if (is_number(a) && is_number(b))
+		{
+			if (a.index() == 2 && b.index() == 2)
+			{
+				return std::get<int64_t>(a) == std::get<int64_t>(b);
+			}
+
+			return as_double(a) == as_double(b);
+		}
+
+		return a == b;
+	}
+
+	// -1, 0 or 1. nothing if the values can not be ordered
+	std::optional<int> order(const Scalar &a, const Scalar &b)
+	{
+		if (is_number(a) && is_number(b))
+		{
+			if (a.index() == 2 && b.index() == 2)
+			{
+				int64_t x = std::get<int64_t>(a);
+				int64_t y = std::get<int64_t>(b);
+				return (x > y) - (x < y);
+			}
+
+			double x = as_double(a);
+			double y = as_double(b);
+
+			// nan can not be ordered
+			if (x != x || y != y)
+			{
+				return std::nullopt;
+			}
+
+			return (x > y) - (x < y);
+		}
+
+		if (a.index() == 4 && b.index() == 4)
+		{
+			int c = std::get<std::string_view>(a).compare(std::get<std::string_view>(b));
+			return (c > 0) - (c < 0);
+		}
+
+		return std::nullopt;
+	}
+
+	Outcome evaluate(const Program &program, const Input &input)
+	{
+		// most programs need only a few slots so the stack only goes on the heap for big ones
+		Scalar local[16];
+		std::vector<Scalar> heap;
+
+		Scalar *stack = local;
+
+		if (program.stack_size > std::size(local))
+		{
+			heap.resize(program.stack_size);
+			stack = heap.data();
+		}
+
+		size_t top = 0;
+
+		// the value is only viewed as a map once a field is asked for
+		std::optional<ambry::View> root;
+		bool root_read = false;
+
+		auto error = [](std::string_view message) { return Outcome { false, false, message }; };
+
+		for (size_t pc = 0; pc < program.code.size(); pc++)
+		{
+			const Instr &instr = program.code[pc];
+
+			switch (instr.op)
+			{
+				case Op::Push:
+				{
+					stack[top++] = program.constants[instr.arg];
+					break;
+				}
+				case Op::PushString:
+				{
+					stack[top++] = std::string_view(program.strings[instr.arg]);
+					break;
+				}
+				case Op::Value:
+				{
+					stack[top++] = input.value ? read_value(*input.value) : Scalar();
+					break;
+				}
+				case Op::Exists:
+				{
+					stack[top++] = input.value.has_value();
+					break;
+				}
+				case Op::Field:
+				{
+					if (!root_read)
+					{
+						root_read = true;
+
+						if (input.value)
+						{
+							root = ambry::View::from(*input.value);
+						}
+
+						if (root && root->type() != ambry::MapT)
+						{
+							root.reset();
+						}
+					}
+
+					std::optional<ambry::View> view = root;
+
+					for (const auto &key : program.paths[instr.arg])
+					{
+						if (!view)
+						{
+							break;
+						}
+
+						view = view->find(key);
+					}
+
+					if (!view)
+					{
+						stack[top++] = Scalar();
+						break;
+					}
+
+					auto field = read_field(*view);
+
+					if (!field)
+					{
+						return error("fields have to be numbers or strings");
+					}
+
+					stack[top++] = *field;
+
+					break;
+				}
+				case Op::Not:
+				{
+					stack[top-1] = !truthy(stack[top-1]);
+					break;
+				}
+				case Op::Neg:
+				{
+					Scalar &s = stack[top-1];
+
+					if (s.index() == 2 && std::get<int64_t>(s) != std::numeric_limits<int64_t>::min())
+					{
+						s = -std::get<int64_t>(s);
+					}
+					else if (s.index() == 3)
+					{
+						s = -std::get<double>(s);
+					}
+					else
+					{
+						return error("- needs a number");
+					}
+
+					break;
+				}
+				case Op::Add:
+				case Op::Sub:
+				case Op::Mul:
+				case Op::Div:
+				case Op::Mod:
+				{
+					auto [value, message] = arithmetic(instr.op, stack[top-2], stack[top-1]);
+
+					if (!message.empty())
+					{
+						return error(message);
+					}
+
+					stack[top-2] = value;
+					top--;
+
+					break;
+				}
+				case Op::Eq:
+				case Op::Ne:
+				{
+					bool eq = equal(stack[top-2], stack[top-1]);
+
+					stack[top-2] = instr.op == Op::Eq ? eq : !eq;
+					top--;
+
+					break;
+				}
+				case Op::Lt:
+				case Op::Le:
+				case Op::Gt:
+				case Op::Ge:
+				{
+					auto c = order(stack[top-2], stack[top-1]);
+
+					if (!c)
+					{
+						return error("only two numbers or two strings can be ordered");
+					}
+
+					bool result =
+						instr.op == Op::Lt ? *c < 0 :
+						instr.op == Op::Le ? *c <= 0 :
+						instr.op == Op::Gt ? *c > 0 :
+						*c >= 0;
+
+					stack[top-2] = result;
+					top--;
+
+					break;
+				}
+				case Op::JumpIfFalseOrPop:
+				case Op::JumpIfTrueOrPop:
+				{
+					bool jump = truthy(stack[top-1]) == (instr.op == Op::JumpIfTrueOrPop);
+
+					if (jump)
+					{
+						// the loop moves past the target so it is jumped to one early
+						pc = instr.arg - 1;
+					}
+					else
+					{
+						top--;
+					}
+
+					break;
+				}
+			}
+		}
+
+		return { true, top > 0 && truthy(stack[top-1]) };
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+/*
+	a small expression language for conditions that run on the server. an expression is compiled once
+	into bytecode and then run against the current value of a key. it has no loops, calls or assignments
+	so a program can never run for longer than its length and never touches anything but the value
+
+	literals     10 -2.5 "text" true false null
+	value        the current value. decimal numbers are read as numbers, anything else as a string
+	exists       true if the key has a value
+	$a.b.c       a field of a value holding a serialized map. null if it is missing
+	operators    || && ! == != < <= > >= + - * / % and parentheses
+*/
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace aci::expr
+{
+	// the longest expression that will be compiled
+	constexpr size_t MAX_SOURCE = 4096;
+
+	// how deeply parentheses and unary operators can nest
+	constexpr size_t MAX_DEPTH = 64;
+
+	// strings view either the program or the value it is run against so evaluating never allocates
+	using Scalar = std::variant<std::monostate, bool, int64_t, double, std::string_view>;
+
+	enum class Op : uint8_t
+	{
+		// pushes constants[arg]
+		Push,
+		// pushes strings[arg]
+		PushString,
+		// pushes the field at paths[arg]
+		Field,
+		Value,
+		Exists,
+		Not,
+		Neg,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Mod,
+		Eq,
+		Ne,
+		Lt,
+		Le,
+		Gt,
+		Ge,
+		// jumps to arg keeping the top of the stack if it is false. otherwise pops it
+		JumpIfFalseOrPop,
+		// jumps to arg keeping the top of the stack if it is true. otherwise pops it
+		JumpIfTrueOrPop,
+	};
+
+	struct Instr
+	{
+		Op op;
+		uint32_t arg = 0;
+	};
+
+	struct Program
+	{
+		std::vector<Instr> code;
+		// numbers, bools and null
+		std::vector<Scalar> constants;
+		std::vector<std::string> strings;
+		std::vector<std::vector<std::string>> paths;
+		// the deepest the stack gets so it can be sized up front
+		size_t stack_size = 0;
+	};
+
+	// the value a program is run against. value is empty if the key does not exist
+	struct Input
+	{
+		std::optional<std::string_view> value;
+	};
+
+	struct Outcome
+	{
+		bool ok = true;
+		bool result = false;
+		std::string_view error;
+	};
+
+	// compiles source or sets error and returns nothing
+	std::optional<Program> compile(std::string_view source, std::string &error);
+
+	// runs a program and reports whether its result is truthy
+	Outcome evaluate(const Program &program, const Input &input);
+}
@@ -0,0 +1,485 @@
+#include "db.hpp"
+#include "asf.hpp"
+#include "asf_v2.hpp"
+#include "asf_pmr.hpp"
+#include "asf_view.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+#include "fmt.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	ambry microbenchmarks
+
+	usage: ambry_bench [-ops=<n>] [-dir=<path>] [-format=<text|json>] [-filter=<name>]
+
+	every result is one line. with -format=json each line is a json object so runs can be diffed and plotted
+*/
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOpts
+{
+	size_t ops = 100000;
+	std::string dir = "/tmp";
+	bool json = false;
+	std::string filter;
+};
+
+// how big the keys and values of a run are. a max bigger then min picks uniformly random sizes
+struct Distribution
+{
+	std::string_view name;
+	size_t key_size;
+	size_t min_value;
+	size_t max_value;
+};
+
+struct BenchResult
+{
+	std::string name;
+	std::string params;
+	size_t ops;
+	double seconds;
+	size_t bytes;
+	ambry::HistogramSnapshot latency;
+};
+
+static BenchOpts opts;
+
+// large values run fewer ops so a run never writes more then this
+constexpr size_t MAX_BENCH_BYTES = 256 * 1024 * 1024;
+
+void report(const BenchResult &r)
+{
+	double ops_per_sec = r.ops / r.seconds;
+	double mb_per_sec = r.bytes / r.seconds / (1024 * 1024);
+
+	if (opts.json)
+	{
+		fmt::println("{{\"bench\":\"{}\",{},\"ops\":{},\"seconds\":{},\"ops_per_sec\":{},\"mb_per_sec\":{},\"p50_ns\":{},\"p99_ns\":{},\"p999_ns\":{},\"max_ns\":{}}",
+			r.name, r.params, r.ops, r.seconds, ops_per_sec, mb_per_sec,
+			r.latency.percentile(50), r.latency.percentile(99), r.latency.percentile(99.9), r.latency.max);
+	}
+	else
+	{
+		fmt::println("{} [{}] ops={} ops/s={} MB/s={} p50={}ns p99={}ns p999={}ns max={}ns",
+			r.name, r.params, r.ops, size_t(ops_per_sec), mb_per_sec,
+			r.latency.percentile(50), r.latency.percentile(99), r.latency.percentile(99.9), r.latency.max);
+	}
+}
+
+bool selected(std::string_view name)
+{
+	return opts.filter.empty() || name.find(opts.filter) != std::string_view::npos;
+}
+
+// times fn(i) for every i in [0, n) and records each call in a histogram
+template<class FN>
+BenchResult run(std::string name, std::string params, size_t n, FN fn)
+{
+	ambry::Histogram histogram;
+
+	size_t bytes = 0;
+
+	auto start = Clock::now();
+
+	for (size_t i = 0; i < n; i++)
+	{
+		auto op_start = Clock::now();
+
+		bytes += fn(i);
+
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - op_start);
+
+		histogram.record(ns.count());
+	}
+
+	std::chrono::duration<double> total = Clock::now() - start;
+
+	return { std::move(name), std::move(params), n, total.count(), bytes, histogram.snapshot() };
+}
+
+std::string make_key(size_t i, size_t size)
+{
+	std::string key = std::to_string(i);
+
+	if (key.size() < size)
+	{
+		key.insert(0, size - key.size(), 'k');
+	}
+
+	return key;
+}
+
+void bench_db(const Distribution &dist, bool cached)
+{
+	std::string path = opts.dir + "/ambry_bench_" + std::string(dist.name) + (cached ? "_cached" : "_uncached");
+
+	ambry::destroy(path);
+
+	ambry::DB db(path, { .enable_cache = cached, .enable_stats = false });
+
+	ambry::Result result = db.open();
+
+	if (!result.ok())
+	{
+		fmt::fatal("could not open {}: {}\n", path, result.message);
+	}
+
+	std::mt19937_64 rng(42);
+
+	std::uniform_int_distribution<size_t> value_size(dist.min_value, dist.max_value);
+
+	size_t avg_value = (dist.min_value + dist.max_value) / 2;
+	size_t ops = std::min(opts.ops, std::max<size_t>(1000, MAX_BENCH_BYTES / avg_value));
+
+	std::vector<std::string> keys;
+	std::vector<std::string> values;
+
+	keys.reserve(ops);
+	values.reserve(ops);
+
+	for (size_t i = 0; i < ops; i++)
+	{
+		keys.push_back(make_key(i, dist.key_size));
+		values.emplace_back(value_size(rng), char('a' + i % 26));
+	}
+
+	// reads and updates visit the keys in a random order so they do not just walk the file
+	std::vector<size_t> order(ops);
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+
+	std::shuffle(order.begin(), order.end(), rng);
+
+	std::string params = fmt::format(opts.json
+		? "\"dist\":\"{}\",\"cached\":{},\"key_size\":{},\"min_value\":{},\"max_value\":{}"
+		: "dist={} cached={} key_size={} value_size={}-{}",
+		dist.name, cached, dist.key_size, dist.min_value, dist.max_value);
+
+	if (selected("db.set"))
+	{
+		report(run("db.set", params, ops, [&](size_t i)
+		{
+			db.set(keys[i], values[i]);
+			return keys[i].size() + values[i].size();
+		}));
+	}
+	else
+	{
+		for (size_t i = 0; i < ops; i++)
+		{
+			db.set(keys[i], values[i]);
+		}
+	}
+
+	if (selected("db.get"))
+	{
+		report(run("db.get", params, ops, [&](size_t i)
+		{
+			const std::string &key = keys[order[i]];
+
+			if (cached)
+			{
+				return db.get_cached(key).value().size();
+			}
+
+			return db.get(key).value().size();
+		}));
+	}
+
+	if (selected("db.update"))
+	{
+		// the new values are a random size so both in place and relocating updates are exercised
+		std::vector<std::string> updates;
+
+		updates.reserve(ops);
+
+		for (size_t i = 0; i < ops; i++)
+		{
+			updates.emplace_back(value_size(rng), char('A' + i % 26));
+		}
+
+		report(run("db.update", params, ops, [&](size_t i)
+		{
+			size_t n = order[i];
+			db.update(keys[n], updates[n]);
+			return updates[n].size();
+		}));
+	}
+
+	if (selected("db.iterate"))
+	{
+		size_t bytes = 0;
+		size_t count = 0;
+
+		auto start = Clock::now();
+
+		for (auto [key, value] : db)
+		{
+			bytes += key.size() + value.size();
+			count++;
+		}
+
+		std::chrono::duration<double> total = Clock::now() - start;
+
+		// iteration is timed as a whole since a single step is too short to measure
+		report({ "db.iterate", params, count, total.count(), bytes, {} });
+	}
+
+	if (selected("db.erase"))
+	{
+		report(run("db.erase", params, ops, [&](size_t i)
+		{
+			db.erase(keys[order[i]]);
+			return size_t(0);
+		}));
+	}
+
+	db.destroy();
+}
+
+// a document shaped like a user profile with a few nested containers
+ambry::Map make_document(size_t tags)
+{
+	ambry::Array tag_list;
+
+	for (size_t i = 0; i < tags; i++)
+	{
+		tag_list.emplace_back("tag_" + std::to_string(i));
+	}
+
+	ambry::Array scores;
+
+	for (size_t i = 0; i < tags; i++)
+	{
+		scores.emplace_back(int64_t(i * 7));
+	}
+
+	ambry::Map settings
+	{
+		{"theme", "dark"},
+		{"notifications", uint8_t(1)},
+		{"volume", 0.75},
+	};
+
+	return
+	{
+		{"id", uint64_t(123456789)},
+		{"name", "john doe"},
+		{"email", "johns@email.com"},
+		{"age", uint16_t(42)},
+		{"active", uint8_t(1)},
+		{"balance", 1032.55},
+		{"tags", std::move(tag_list)},
+		{"scores", std::move(scores)},
+		{"settings", std::move(settings)},
+	};
+}
+
+void bench_asf(size_t tags)
+{
+	ambry::Map doc = make_document(tags);
+
+	std::string encoded = ambry::serialize(doc);
+	std::string encoded_v2 = ambry::serialize_v2(doc);
+
+	std::string params = fmt::format(opts.json
+		? "\"array_size\":{},\"encoded_size\":{},\"v2_encoded_size\":{}"
+		: "array_size={} encoded_size={} v2_encoded_size={}",
+		tags, encoded.size(), encoded_v2.size());
+
+	if (selected("asf.serialize"))
+	{
+		report(run("asf.serialize", params, opts.ops, [&](size_t)
+		{
+			return ambry::serialize(doc).size();
+		}));
+	}
+
+	if (selected("asf.deserialize"))
+	{
+		report(run("asf.deserialize", params, opts.ops, [&](size_t)
+		{
+			auto map = ambry::deserialize(encoded);
+			return map ? encoded.size() : 0;
+		}));
+	}
+
+	if (selected("asf.pmr.deserialize"))
+	{
+		// one arena reused for every decode the way a request scoped arena would be
+		std::pmr::monotonic_buffer_resource arena;
+
+		report(run("asf.pmr.deserialize", params, opts.ops, [&](size_t)
+		{
+			size_t size = 0;
+
+			{
+				auto map = ambry::pmr::deserialize(encoded, &arena);
+				size = map ? encoded.size() : 0;
+			}
+
+			arena.release();
+
+			return size;
+		}));
+	}
+
+	if (selected("asf.v2.serialize"))
+	{
+		report(run("asf.v2.serialize", params, opts.ops, [&](size_t)
+		{
+			return ambry::serialize_v2(doc).size();
+		}));
+	}
+
+	if (selected("asf.v2.deserialize"))
+	{
+		report(run("asf.v2.deserialize", params, opts.ops, [&](size_t)
+		{
+			auto map = ambry::deserialize(encoded_v2);
+			return map ? encoded_v2.size() : 0;
+		}));
+	}
+
+	// the same numbers stored as one value each and as a packed array
+	ambry::Array numbers;
+	std::vector<double> packed_numbers;
+
+	for (size_t i = 0; i < tags; i++)
+	{
+		numbers.emplace_back(i * 0.5);
+		packed_numbers.push_back(i * 0.5);
+	}
+
+	for (auto [name, value] : { std::pair{ "asf.numbers", ambry::Value(std::move(numbers)) }, { "asf.packed", ambry::Value(std::move(packed_numbers)) } })
+	{
+		ambry::Map map { { "values", std::move(value) } };
+
+		std::string buff = ambry::serialize(map);
+
+		std::string name_serialize = std::string(name) + ".serialize";
+		std::string name_deserialize = std::string(name) + ".deserialize";
+
+		std::string numbers_params = fmt::format(opts.json
+			? "\"array_size\":{},\"encoded_size\":{}"
+			: "array_size={} encoded_size={}",
+			tags, buff.size());
+
+		if (selected(name_serialize))
+		{
+			report(run(name_serialize, numbers_params, opts.ops, [&](size_t)
+			{
+				return ambry::serialize(map).size();
+			}));
+		}
+
+		if (selected(name_deserialize))
+		{
+			report(run(name_deserialize, numbers_params, opts.ops, [&](size_t)
+			{
+				auto out = ambry::deserialize(buff);
+				return out ? buff.size() : 0;
+			}));
+		}
+	}
+
+	// a map as wide as the arrays so lookups show how they scale with the number of fields
+	ambry::Map wide;
+
+	for (size_t i = 0; i < tags; i++)
+	{
+		wide.emplace("field_" + std::to_string(i), uint64_t(i));
+	}
+
+	std::string wide_v1 = ambry::serialize(wide);
+	std::string wide_v2 = ambry::serialize_v2(wide);
+	std::string last = "field_" + std::to_string(tags-1);
+
+	for (auto [name, buff] : { std::pair{ "asf.find", std::string_view(wide_v1) }, { "asf.v2.find", wide_v2 } })
+	{
+		if (!selected(name))
+		{
+			continue;
+		}
+
+		report(run(name, params, opts.ops, [&](size_t)
+		{
+			auto view = ambry::View::from(buff);
+			auto field = view ? view->find(last) : std::nullopt;
+			return field ? sizeof(uint64_t) : 0;
+		}));
+	}
+}
+
+void parse_opts(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+
+		size_t sep = arg.find('=');
+
+		std::string_view name = arg.substr(0, sep);
+		std::string_view value = sep == std::string_view::npos ? "" : arg.substr(sep+1);
+
+		if (name == "-ops")
+		{
+			opts.ops = std::stoull(std::string(value));
+		}
+		else if (name == "-dir")
+		{
+			opts.dir = value;
+		}
+		else if (name == "-format")
+		{
+			opts.json = value == "json";
+		}
+		else if (name == "-filter")
+		{
+			opts.filter = value;
+		}
+		else
+		{
+			fmt::fatal("usage: ambry_bench [-ops=<n>] [-dir=<path>] [-format=<text|json>] [-filter=<name>]\n");
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	parse_opts(argc, argv);
+
+	const Distribution distributions[]
+	{
+		{ "small", 16, 32, 32 },
+		{ "medium", 32, 1024, 1024 },
+		{ "large", 64, 16384, 16384 },
+		{ "mixed", 24, 16, 4096 },
+	};
+
+	for (const auto &dist : distributions)
+	{
+		bench_db(dist, true);
+		bench_db(dist, false);
+	}
+
+	for (size_t tags : { 4, 64, 1024 })
+	{
+		bench_asf(tags);
+	}
+}
@@ -1,4 +1,7 @@
 #include "asf.hpp"
+#include "asf_common.hpp"
+#include "asf_v2.hpp"
+#include "asf_view.hpp"
 #include "util.hpp"
 
 #include <algorithm>
@@ -6,149 +9,201 @@
 
 #include "../shared/fmt.hpp"
 
-// one byte for the type, 4 for the size.
-// a serialized value should always be more than this
-constexpr int VALUE_HEADER_SIZE = 5;
-// one byte is for type (1 key value, 2 single value) and one byte for endianness
-constexpr int HEADER_SIZE = 2;
+/*
+	serialization is done in two passes. the first one works out the exact encoded size
+	so the second can write the whole tree into a single buffer without any intermediate strings
+*/
 
-template<class T>
-void write_to(std::string &buff, T n)
-{
-	auto *bytes = (char*)&n;
-
-	for (size_t i = 0; i < sizeof(T); i++)
-	{
-		buff += bytes[i];
-	}
-}
+size_t encoded_size(const ambry::Value &value);
 
-template<class T>
-T read_to(std::string_view buff, bool should_reverse = false)
+size_t map_body_size(const ambry::Map &map)
 {
-	T n;
-
-	auto *bytes = (char*)&n;
+	// the element count
+	size_t size = 4;
 
-	for (size_t i = 0; i < sizeof(T); i++)
+	for (const auto &[key, value] : map)
 	{
-		bytes[i] = buff[i];
+		size += 2 + key.size() + encoded_size(value);
 	}
 
-	if (should_reverse)
-	{
-		std::reverse(bytes, bytes+sizeof(T));
-	}
-
-	n = *(T*)bytes;
-
-	return n;
+	return size;
 }
 
-std::string _serialize(const ambry::Value &value);
-
-std::string serialize_string(const ambry::Value &value)
+size_t encoded_size(const ambry::Value &value)
 {
-	std::string buff;
-
-	auto str = std::get<ambry::StringT>(value);
-
-	write_to(buff, (uint32_t)str.size());
-
-	buff += str;
-
-	return buff;
-}
+	using namespace ambry;
 
-std::string serialize_array(const ambry::Value &value)
-{
-	std::string buff;
+	switch (value.index())
+	{
+		case I8: case U8:   return VALUE_HEADER_SIZE + 1;
+		case I16: case U16: return VALUE_HEADER_SIZE + 2;
+		case I32: case U32: return VALUE_HEADER_SIZE + 4;
+		case I64: case U64: return VALUE_HEADER_SIZE + 8;
+		case Double:        return VALUE_HEADER_SIZE + sizeof(double);
+		case StringT:
+		{
+			return VALUE_HEADER_SIZE + std::get<StringT>(value).size();
+		}
+		case ArrayT:
+		{
+			size_t size = VALUE_HEADER_SIZE;
 
-	auto vec = std::get<ambry::Array>(value);
+			for (const auto &val : std::get<ArrayT>(value))
+			{
+				size += encoded_size(val);
+			}
 
-	write_to(buff, (uint32_t)vec.size());
+			return size;
+		}
+		case MapT:
+		{
+			// the map body starts with its own count so the header length field is reused for it
+			return VALUE_HEADER_SIZE - 4 + map_body_size(std::get<MapT>(value));
+		}
+		case PackedT:
+		{
+			const auto &packed = std::get<PackedT>(value);
 
-	for (const auto &val : vec)
-	{
-		buff += _serialize(val);
+			// one byte for the element type
+			return VALUE_HEADER_SIZE + 1 + packed.size() * packed.element_size();
+		}
 	}
 
-	return buff;
+	return 0;
 }
 
-std::string serialize_map(const ambry::Value &value)
-{
-	std::string buff;
+char *write_value(char *out, const ambry::Value &value);
 
-	auto map = std::get<ambry::MapT>(value);
-
-	write_to(buff, (uint32_t)map.size());
+char *write_map(char *out, const ambry::Map &map)
+{
+	out = put(out, (uint32_t)map.size());
 
-	for (const auto &[key, value]: map)
+	for (const auto &[key, value] : map)
 	{
-		write_to(buff, (uint16_t)key.size());
-
-		buff += key;
-
-		buff += _serialize(value);
+		out = put(out, (uint16_t)key.size());
+		out = put_bytes(out, key);
+		out = write_value(out, value);
 	}
 
-	return buff;
+	return out;
 }
 
-std::string _serialize(const ambry::Value &value)
+char *write_value(char *out, const ambry::Value &value)
 {
-	std::string buff;
-
-	write_to(buff, (uint8_t)value.index());
+	out = put(out, (uint8_t)value.index());
 
-#define INTEGRAL_CASE(t, s) case t: write_to(buff, s); write_to(buff, std::get<t>(value));  break;
+#define INTEGRAL_CASE(t) \
+	case t: \
+	{ \
+		auto n = std::get<t>(value); \
+		out = put(out, (uint32_t)sizeof(n)); \
+		return put(out, n); \
+	} \
 
 	using namespace ambry;
 
 	switch (value.index())
 	{	
-		INTEGRAL_CASE(I8, 1)
-		INTEGRAL_CASE(U8, 1)
-		INTEGRAL_CASE(I16, 2)
-		INTEGRAL_CASE(U16, 2)
-		INTEGRAL_CASE(I32, 4)
-		INTEGRAL_CASE(U32, 4)
-		INTEGRAL_CASE(I64, 8)
-		INTEGRAL_CASE(U64, 8)
-		INTEGRAL_CASE(Double, sizeof(double))
+		INTEGRAL_CASE(I8)
+		INTEGRAL_CASE(U8)
+		INTEGRAL_CASE(I16)
+		INTEGRAL_CASE(U16)
+		INTEGRAL_CASE(I32)
+		INTEGRAL_CASE(U32)
+		INTEGRAL_CASE(I64)
+		INTEGRAL_CASE(U64)
+		INTEGRAL_CASE(Double)
 		case StringT:
 		{
-			buff += serialize_string(value);
-			break;
+			const auto &str = std::get<StringT>(value);
+
+			out = put(out, (uint32_t)str.size());
+
+			return put_bytes(out, str);
 		}
 		case ArrayT:
 		{
-			buff += serialize_array(value);
-			break;
+			const auto &vec = std::get<ArrayT>(value);
+
+			out = put(out, (uint32_t)vec.size());
+
+			for (const auto &val : vec)
+			{
+				out = write_value(out, val);
+			}
+
+			return out;
 		}
 		case MapT:
 		{
-			buff += serialize_map(value);
-			break;
+			return write_map(out, std::get<MapT>(value));
+		}
+		case PackedT:
+		{
+			const auto &packed = std::get<PackedT>(value);
+
+			out = put(out, (uint32_t)packed.size());
+			out = put(out, (uint8_t)packed.index());
+
+			return put_bytes(out, { packed.data(), packed.size() * packed.element_size() });
 		}
 	}
 
-	return buff;
+	return out;
 
 #undef INTEGRAL_CASE
 }
 
+size_t ambry::serialized_size(const Map &map)
+{
+	return HEADER_SIZE + map_body_size(map);
+}
+
+size_t ambry::serialized_size(const Value &value)
+{
+	return HEADER_SIZE + encoded_size(value);
+}
+
+size_t ambry::serialize_into(const Map &map, char *out)
+{
+	char *start = out;
+
+	// data type (key value pairs)
+	*out++ = 1;
+	// the endianness of the data (1 for little 0 for big)
+	*out++ = machine_endian();
+
+	return write_map(out, map) - start;
+}
+
+size_t ambry::serialize_value_into(const Value &value, char *out)
+{
+	char *start = out;
+
+	// data type (single value)
+	*out++ = 2;
+	// the endianness of the data (1 for little 0 for big)
+	*out++ = machine_endian();
+
+	return write_value(out, value) - start;
+}
+
+void ambry::serialize(const Map &map, std::string &buff)
+{
+	size_t offset = buff.size();
+
+	buff.resize(offset + serialized_size(map));
+
+	serialize_into(map, buff.data() + offset);
+}
+
 std::string ambry::serialize_value(const Value &value)
 {
 	std::string buff;
 	
-	// data type (single value)
-	buff += 2;
-	// the endianness of the data (1 for little 0 for big)
-	buff += machine_endian();
+	buff.resize(serialized_size(value));
 
-	buff += _serialize(value);
+	serialize_value_into(value, buff.data());
 
 	return buff;
 }
@@ -156,17 +211,58 @@ std::string ambry::serialize_value(const Value &value)
 std::string ambry::serialize(const Map &map)
 {
 	std::string buff;
-	
-	// data type (key value pairs)
-	buff += 1;
-	// the endianness of the data (1 for little 0 for big)
-	buff += machine_endian();
 
-	buff += serialize_map(map);
+	serialize(map, buff);
 
 	return buff;
 }
 
+std::optional<ambry::PackedArray> ambry::PackedArray::of(uint8_t element_type, size_t count)
+{
+#define ELEMENT_CASE(i) case i: return PackedArray(std::in_place_index<i>, count);
+
+	switch (element_type)
+	{
+		ELEMENT_CASE(0)
+		ELEMENT_CASE(1)
+		ELEMENT_CASE(2)
+		ELEMENT_CASE(3)
+		ELEMENT_CASE(4)
+		ELEMENT_CASE(5)
+		ELEMENT_CASE(6)
+		ELEMENT_CASE(7)
+		ELEMENT_CASE(8)
+		ELEMENT_CASE(9)
+		default: return std::nullopt;
+	}
+
+#undef ELEMENT_CASE
+}
+
+std::optional<ambry::PackedArray> read_packed(std::string_view buff, uint8_t element_type, uint64_t count, bool should_reverse)
+{
+	size_t width = packed_element_size(element_type);
+
+	if (width == 0 || count > buff.size() / width)
+	{
+		return std::nullopt;
+	}
+
+	auto packed = ambry::PackedArray::of(element_type, count);
+
+	if (count)
+	{
+		std::memcpy(packed->data(), buff.data(), count * width);
+	}
+
+	if (should_reverse)
+	{
+		reverse_elements(packed->data(), count, width);
+	}
+
+	return packed;
+}
+
 std::optional<
 	std::pair<ambry::Value, size_t>> 
 _deserialize(std::string_view buff, bool should_reverse);
@@ -237,7 +333,7 @@ _deserialize(std::string_view buff, bool should_reverse)
 {
 	uint8_t type = buff[0];
 
-	auto len = read_to<uint32_t>(buff.data()+1);
+	auto len = read_to<uint32_t>(buff.substr(1), should_reverse);
 
 	buff = buff.substr(VALUE_HEADER_SIZE);
 
@@ -275,6 +371,25 @@ _deserialize(std::string_view buff, bool should_reverse)
 
 			return opt.value();
 		}
+		case PackedT:
+		{
+			if (buff.empty())
+			{
+				return std::nullopt;
+			}
+
+			auto packed = read_packed(buff.substr(1), buff[0], len, should_reverse);
+
+			if (!packed)
+			{
+				return std::nullopt;
+			}
+
+			size_t size = 1 + packed->size() * packed->element_size();
+
+			return {{ std::move(*packed), size }};
+		}
+		default: return std::nullopt;
 	}
 
 #undef INTEGRAL_CASE
@@ -292,11 +407,16 @@ _deserialize(std::string_view buff, bool should_reverse)
 std::optional<ambry::Value> 
 ambry::deserialize_value(std::string_view buff)
 {
+	if (is_v2(buff))
+	{
+		return deserialize_value_v2(buff);
+	}
+
 	DESERIALIZE_CHECK(is_map);
 
 	bool should_reverse = buff[1] != machine_endian();
 
-	auto opt = _deserialize(buff.substr(6), should_reverse);
+	auto opt = _deserialize(buff.substr(HEADER_SIZE), should_reverse);
 
 	if (!opt)
 	{
@@ -309,11 +429,16 @@ ambry::deserialize_value(std::string_view buff)
 std::optional<ambry::Map> 
 ambry::deserialize(std::string_view buff)
 {
+	if (is_v2(buff))
+	{
+		return deserialize_v2(buff);
+	}
+
 	DESERIALIZE_CHECK(is_single);
 	
 	bool should_reverse = buff[1] != machine_endian();
 
-	auto len = read_to<uint32_t>(buff.substr(2));
+	auto len = read_to<uint32_t>(buff.substr(2), should_reverse);
 
 	auto opt = deserialize_map(buff.substr(6), should_reverse, len);
 
@@ -331,11 +456,24 @@ std::string ambry::to_string(const Value &value)
 
 	switch (value.index())
 	{
+		INTEGRAL_CASE(I8)
+		INTEGRAL_CASE(U8)
+		INTEGRAL_CASE(I16)
+		INTEGRAL_CASE(U16)
 		INTEGRAL_CASE(I32)
+		INTEGRAL_CASE(U32)
+		INTEGRAL_CASE(I64)
+		INTEGRAL_CASE(U64)
+		INTEGRAL_CASE(Double)
 		case StringT: return "\"" + std::get<StringT>(value) + "\"";
 		case ArrayT:
 		{
-			auto vec = std::get<ArrayT>(value);
+			const auto &vec = std::get<ArrayT>(value);
+
+			if (vec.empty())
+			{
+				return "[]";
+			}
 
 			auto iter = vec.begin();
 
@@ -354,7 +492,7 @@ std::string ambry::to_string(const Value &value)
 		{
 			std::string buff = "{\n";
 
-			auto map = std::get<MapT>(value);
+			const auto &map = std::get<MapT>(value);
 
 			for (const auto &[k, v] : map)
 			{
@@ -365,8 +503,29 @@ std::string ambry::to_string(const Value &value)
 
 			return buff;
 		}
+		case PackedT:
+		{
+			return std::visit([](const auto &vec)
+			{
+				if (vec.empty())
+				{
+					return std::string("[]");
+				}
+
+				std::string buff = "[ " + std::to_string(vec[0]);
+
+				for (size_t i = 1; i < vec.size(); i++)
+				{
+					buff += ", " + std::to_string(vec[i]);
+				}
+
+				return buff + " ]";
+			}, std::get<PackedT>(value));
+		}
 	}
 
+	return {};
+
 #undef INTEGRAL_CASE
 }
 
@@ -392,7 +551,7 @@ deserialize_map(std::string_view buff, bool should_reverse, uint32_t len, ambry:
 		{
 			return std::nullopt;
 		}
-		else
+		else if (iter != schema.fields.end())
 		{
 			iter->second.found = true;
 		}
@@ -438,13 +597,68 @@ deserialize_map(std::string_view buff, bool should_reverse, uint32_t len, ambry:
 
 #undef CHECK
 
+// v2 maps are decoded first and then checked against the schema
+std::optional<ambry::Map> validate(ambry::Map &&map, ambry::Schema &schema)
+{
+	for (auto &[key, value] : map)
+	{
+		auto iter = schema.fields.find(key);
+
+		if (iter == schema.fields.end())
+		{
+			if (!schema.opts.allow_undefined)
+			{
+				return std::nullopt;
+			}
+
+			continue;
+		}
+
+		ambry::SchemaField &field = iter->second;
+
+		field.found = true;
+
+		if (field.type != ambry::AnyT && value.index() != field.type)
+		{
+			return std::nullopt;
+		}
+
+		if (field.fn && !field.fn(value))
+		{
+			return std::nullopt;
+		}
+	}
+
+	for (auto &[_, field] : schema.fields)
+	{
+		if (!field.optional && !field.found)
+		{
+			return std::nullopt;
+		}
+	}
+
+	return std::move(map);
+}
+
 std::optional<ambry::Map> ambry::deserialize(std::string_view buff, Schema &schema)
 {
+	if (is_v2(buff))
+	{
+		auto map = deserialize_v2(buff);
+
+		if (!map)
+		{
+			return std::nullopt;
+		}
+
+		return validate(std::move(*map), schema);
+	}
+
 	DESERIALIZE_CHECK(is_single);
 	
 	bool should_reverse = buff[1] != machine_endian();
 
-	auto len = read_to<uint32_t>(buff.substr(2));
+	auto len = read_to<uint32_t>(buff.substr(2), should_reverse);
 
 	auto opt = deserialize_map(buff.substr(6), should_reverse, len, schema);
 
@@ -455,3 +669,250 @@ std::optional<ambry::Map> ambry::deserialize(std::string_view buff, Schema &sche
 
 	return opt.value().first;
 }
+
+
+ambry::CompiledSchema::CompiledSchema(const Schema &schema) :
+	m_allow_undefined(schema.opts.allow_undefined)
+{
+	m_fields.reserve(schema.fields.size());
+
+	for (const auto &[name, field] : schema.fields)
+	{
+		m_fields.push_back({ std::string{ name }, field.type, field.optional, field.fn });
+	}
+
+	std::sort(m_fields.begin(), m_fields.end(), [](const Field &a, const Field &b)
+	{
+		return a.name < b.name;
+	});
+
+	m_required.resize((m_fields.size() + 63) / 64);
+
+	for (size_t i = 0; i < m_fields.size(); i++)
+	{
+		if (!m_fields[i].optional)
+		{
+			m_required[i / 64] |= uint64_t(1) << (i % 64);
+		}
+	}
+}
+
+size_t ambry::CompiledSchema::find(std::string_view name) const
+{
+	auto iter = std::lower_bound(m_fields.begin(), m_fields.end(), name, [](const Field &field, std::string_view name)
+	{
+		return field.name < name;
+	});
+
+	if (iter == m_fields.end() || iter->name != name)
+	{
+		return std::string::npos;
+	}
+
+	return iter - m_fields.begin();
+}
+
+bool ambry::CompiledSchema::complete(const uint64_t *found) const
+{
+	for (size_t i = 0; i < m_required.size(); i++)
+	{
+		if (m_required[i] & ~found[i])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// the fields seen during one decode. small schemas keep it on the stack
+struct FieldMask
+{
+	uint64_t small[4]{};
+	std::vector<uint64_t> large;
+	uint64_t *bits = small;
+
+	explicit FieldMask(size_t fields)
+	{
+		size_t words = (fields + 63) / 64;
+
+		if (words > std::size(small))
+		{
+			large.resize(words);
+			bits = large.data();
+		}
+	}
+
+	FieldMask(const FieldMask&) = delete;
+
+	inline void set(size_t i)
+	{
+		bits[i / 64] |= uint64_t(1) << (i % 64);
+	}
+};
+
+// checks the type of a field and marks it as seen. index is set to npos for fields the schema does not define
+bool mark_field(const ambry::CompiledSchema &schema, FieldMask &mask, std::string_view key, uint8_t type, size_t &index)
+{
+	index = schema.find(key);
+
+	if (index == std::string::npos)
+	{
+		return schema.allow_undefined();
+	}
+
+	const auto &field = schema.field(index);
+
+	if (field.type != ambry::AnyT && field.type != type)
+	{
+		return false;
+	}
+
+	mask.set(index);
+
+	return true;
+}
+
+bool ambry::CompiledSchema::validate(std::string_view buff) const
+{
+	auto view = View::from(buff);
+
+	if (!view || view->type() != MapT)
+	{
+		return false;
+	}
+
+	FieldMask mask(m_fields.size());
+
+	size_t n = 0;
+
+	for (const auto &[key, value] : *view)
+	{
+		size_t index;
+
+		if (!mark_field(*this, mask, key, value.type(), index))
+		{
+			return false;
+		}
+
+		// only fields with a validation function have to be decoded
+		if (index != std::string::npos && m_fields[index].fn)
+		{
+			auto opt = value.value();
+
+			if (!opt || !m_fields[index].fn(*opt))
+			{
+				return false;
+			}
+		}
+
+		n++;
+	}
+
+	// iteration stops early on malformed data
+	return n == view->size() && complete(mask.bits);
+}
+
+std::optional<
+	std::pair<ambry::Map, size_t>>
+deserialize_map(std::string_view buff, bool should_reverse, uint32_t len, const ambry::CompiledSchema &schema)
+{
+	ambry::Map out;
+
+	FieldMask mask(schema.size());
+
+	size_t offset = 0;
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		auto key_len = read_to<uint16_t>(buff.substr(offset), should_reverse);
+
+		std::string_view key = buff.substr(offset+2, key_len);
+
+		offset += 2 + key_len;
+
+		size_t index;
+
+		if (!mark_field(schema, mask, key, buff[offset], index))
+		{
+			return std::nullopt;
+		}
+
+		auto opt = _deserialize(buff.substr(offset), should_reverse);
+
+		if (!opt)
+		{
+			return std::nullopt;
+		}
+
+		auto &[value, size] = opt.value();
+
+		if (index != std::string::npos && schema.field(index).fn && !schema.field(index).fn(value))
+		{
+			return std::nullopt;
+		}
+
+		offset += VALUE_HEADER_SIZE + size;
+
+		out.emplace(key, std::move(value));
+	}
+
+	if (!schema.complete(mask.bits))
+	{
+		return std::nullopt;
+	}
+
+	return {{ out, offset }};
+}
+
+std::optional<ambry::Map> ambry::deserialize(std::string_view buff, const CompiledSchema &schema)
+{
+	if (is_v2(buff))
+	{
+		auto map = deserialize_v2(buff);
+
+		if (!map)
+		{
+			return std::nullopt;
+		}
+
+		FieldMask mask(schema.size());
+
+		for (auto &[key, value] : *map)
+		{
+			size_t index;
+
+			if (!mark_field(schema, mask, key, value.index(), index))
+			{
+				return std::nullopt;
+			}
+
+			if (index != std::string::npos && schema.field(index).fn && !schema.field(index).fn(value))
+			{
+				return std::nullopt;
+			}
+		}
+
+		if (!schema.complete(mask.bits))
+		{
+			return std::nullopt;
+		}
+
+		return map;
+	}
+
+	DESERIALIZE_CHECK(is_single);
+
+	bool should_reverse = buff[1] != machine_endian();
+
+	auto len = read_to<uint32_t>(buff.substr(2), should_reverse);
+
+	auto opt = deserialize_map(buff.substr(6), should_reverse, len, schema);
+
+	if (!opt)
+	{
+		return std::nullopt;
+	}
+
+	return opt.value().first;
+}
\ No newline at end of file
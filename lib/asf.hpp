@@ -14,7 +14,7 @@ namespace ambry
 	enum Type : uint8_t
 	{
 		I8, U8, I16, U16, I32, U32, I64, U64, Double, 
-		StringT, ArrayT, MapT, AnyT
+		StringT, ArrayT, MapT, PackedT, AnyT
 	};
 
 	struct Value;
@@ -22,9 +22,50 @@ namespace ambry
     using Array  = std::vector<Value>;
 	using Map = std::unordered_map<std::string, Value>;
 
+	using PackedBase = std::variant<
+	std::vector<int8_t>, std::vector<uint8_t>, std::vector<int16_t>, std::vector<uint16_t>,
+	std::vector<int32_t>, std::vector<uint32_t>, std::vector<int64_t>, std::vector<uint64_t>,
+	std::vector<float>, std::vector<double>>;
+
+	/*
+		a contiguous array of numbers of a single type. it is serialized as one block of bytes
+		instead of a value per element. the element type is stored as the index of the vector in the variant
+	*/
+	struct PackedArray : public PackedBase
+	{
+		using PackedBase::PackedBase;
+
+		// makes an array of count zeroed elements of the given element type
+		static std::optional<PackedArray> of(uint8_t element_type, size_t count);
+
+		inline size_t size() const
+		{
+			return std::visit([](const auto &vec) { return vec.size(); }, *this);
+		}
+
+		// the size of one element in bytes
+		inline size_t element_size() const
+		{
+			return std::visit([](const auto &vec) { return sizeof(vec[0]); }, *this);
+		}
+
+		inline const char *data() const
+		{
+			return std::visit([](const auto &vec) { return (const char*)vec.data(); }, *this);
+		}
+
+		inline char *data()
+		{
+			return std::visit([](auto &vec) { return (char*)vec.data(); }, *this);
+		}
+	};
+
+	template<class T>
+	constexpr bool is_packable = std::is_constructible_v<PackedBase, T> && !std::is_same_v<std::decay_t<T>, PackedArray>;
+
 	using ValueBase  = std::variant<
 	int8_t, uint8_t, int16_t, uint16_t, int32_t, uint32_t, int64_t, uint64_t, double, 
-	std::string, Array, Map>;
+	std::string, Array, Map, PackedArray>;
 
     struct Value : public ValueBase
     {
@@ -70,6 +111,10 @@ namespace ambry
 			{
                 emplace<std::string>(value);
 			}
+			else if constexpr (is_packable<T>)
+			{
+				emplace<PackedArray>(std::forward<T>(value));
+			}
 			else
 			{
 				emplace<T>(value);
@@ -81,6 +126,17 @@ namespace ambry
 
 	std::string serialize(const Map &map);
 
+	// serializes a map onto the end of buff
+	void serialize(const Map &map, std::string &buff);
+
+	// the exact number of bytes serializing the map or value will produce
+	size_t serialized_size(const Map &map);
+	size_t serialized_size(const Value &value);
+
+	// serializes into a caller provided buffer of at least serialized_size bytes. returns the number of bytes written
+	size_t serialize_into(const Map &map, char *out);
+	size_t serialize_value_into(const Value &value, char *out);
+
 	std::optional<Value> deserialize_value(std::string_view buff);
 
 	std::optional<Map> deserialize(std::string_view buff);
@@ -134,4 +190,55 @@ namespace ambry
 	};
 
 	std::optional<Map> deserialize(std::string_view buff, Schema &schema);
+
+	/*
+		an immutable form of a schema. it is built once and can then be used any number of times
+		and from any number of threads. fields are kept sorted by name and which ones were seen
+		is tracked per decode instead of in the schema
+	*/
+	class CompiledSchema
+	{
+	public:
+		struct Field
+		{
+			std::string name;
+			Type type = AnyT;
+			bool optional = false;
+			ValidateFN fn = nullptr;
+		};
+
+		explicit CompiledSchema(const Schema &schema);
+
+		// the index of a field or npos if the schema does not define it
+		size_t find(std::string_view name) const;
+
+		inline const Field &field(size_t index) const
+		{
+			return m_fields[index];
+		}
+
+		inline size_t size() const
+		{
+			return m_fields.size();
+		}
+
+		inline bool allow_undefined() const
+		{
+			return m_allow_undefined;
+		}
+
+		// checks if every required field is set in a mask that has a bit for each field
+		bool complete(const uint64_t *found) const;
+
+		// checks serialized data against the schema without building a map
+		bool validate(std::string_view buff) const;
+
+	private:
+		std::vector<Field> m_fields;
+		// a bit for every required field
+		std::vector<uint64_t> m_required;
+		bool m_allow_undefined = false;
+	};
+
+	std::optional<Map> deserialize(std::string_view buff, const CompiledSchema &schema);
 };
\ No newline at end of file
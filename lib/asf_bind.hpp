@@ -0,0 +1,529 @@
+#pragma once
+
+/*
+	compile time binding of plain structs to the asf map format.
+
+	a struct is bound by specialising Binding with a tuple of its fields
+
+		struct User
+		{
+			std::string name;
+			uint32_t age;
+			std::vector<std::string> friends;
+			std::optional<std::string> email;
+		};
+
+		template<>
+		struct ambry::Binding<User>
+		{
+			static constexpr auto fields = std::make_tuple(
+				ambry::field("name", &User::name),
+				ambry::field("age", &User::age),
+				ambry::field("friends", &User::friends),
+				ambry::field("email", &User::email));
+		};
+
+	the struct is then written straight to the wire format and read back without going through Map or Value.
+	field types are checked while decoding so a bound struct needs no separate schema.
+	supported field types are arithmetic types, bool, std::string, std::vector, std::optional and other bound structs.
+	vectors of numbers are written as packed arrays
+*/
+
+#include "asf.hpp"
+#include "asf_common.hpp"
+#include "asf_view.hpp"
+#include "util.hpp"
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace ambry
+{
+	template<class C, class M>
+	struct Field
+	{
+		std::string_view name;
+		M C::*member;
+	};
+
+	template<class C, class M>
+	constexpr Field<C, M> field(std::string_view name, M C::*member)
+	{
+		return { name, member };
+	}
+
+	template<class T>
+	struct Binding;
+
+	template<class T>
+	concept Bound = requires { Binding<T>::fields; };
+
+	namespace bind
+	{
+		template<class T> struct is_vector : std::false_type {};
+		template<class T> struct is_vector<std::vector<T>> : std::true_type {};
+
+		template<class T> struct is_optional : std::false_type {};
+		template<class T> struct is_optional<std::optional<T>> : std::true_type {};
+
+		template<class T>
+		constexpr bool always_false = false;
+
+		// the element type of a packed array holding a vector of type M
+		template<class M, size_t I = 0>
+		constexpr uint8_t packed_element()
+		{
+			if constexpr (std::is_same_v<std::variant_alternative_t<I, PackedBase>, M>)
+				return I;
+			else
+				return packed_element<M, I+1>();
+		}
+
+		template<class M>
+		constexpr Type wire_type()
+		{
+			if constexpr (std::is_same_v<M, bool>)
+				return U8;
+			else if constexpr (std::is_floating_point_v<M>)
+				return Double;
+			else if constexpr (std::is_arithmetic_v<M>)
+			{
+				static_assert(View::type_of<M>() != AnyT, "integer fields must be a fixed width type");
+				return View::type_of<M>();
+			}
+			else if constexpr (std::is_same_v<M, std::string>)
+				return StringT;
+			else if constexpr (is_packable<M>)
+				return PackedT;
+			else if constexpr (is_vector<M>::value)
+				return ArrayT;
+			else if constexpr (Bound<M>)
+				return MapT;
+			else
+				static_assert(always_false<M>, "unsupported field type");
+		}
+
+		template<class T>
+		constexpr size_t field_count()
+		{
+			return std::tuple_size_v<std::remove_cvref_t<decltype(Binding<T>::fields)>>;
+		}
+
+		template<class T>
+		constexpr auto field_names()
+		{
+			return std::apply([](auto ...f)
+			{
+				return std::array<std::string_view, sizeof...(f)>{ f.name... };
+			}, Binding<T>::fields);
+		}
+
+		// a bit is set for every field that has to be present
+		template<class T>
+		constexpr uint64_t required_mask()
+		{
+			return std::apply([](auto ...f)
+			{
+				uint64_t mask = 0;
+				size_t i = 0;
+
+				((mask |= uint64_t(!is_optional<std::remove_cvref_t<decltype(std::declval<T>().*f.member)>>::value) << i++), ...);
+
+				return mask;
+			}, Binding<T>::fields);
+		}
+
+		template<class T>
+		constexpr bool unique_names()
+		{
+			constexpr auto names = field_names<T>();
+
+			for (size_t i = 0; i < names.size(); i++)
+			{
+				for (size_t j = i+1; j < names.size(); j++)
+				{
+					if (names[i] == names[j])
+					{
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		template<class T>
+		constexpr void check_binding()
+		{
+			static_assert(field_count<T>() <= 64, "a bound struct can have at most 64 fields");
+			static_assert(unique_names<T>(), "bound field names must be unique");
+		}
+
+		// calls fn with the field at a runtime index
+		template<class T, class FN, size_t ...I>
+		bool visit_field(size_t index, FN &&fn, std::index_sequence<I...>)
+		{
+			bool ok = false;
+
+			((index == I ? (ok = fn(std::get<I>(Binding<T>::fields)), true) : false) || ...);
+
+			return ok;
+		}
+
+		// finds a field by name. the fields are usually stored in declaration order so the hint is checked first
+		template<class T>
+		size_t find_field(std::string_view name, size_t hint)
+		{
+			constexpr auto names = field_names<T>();
+
+			if (hint < names.size() && names[hint] == name)
+			{
+				return hint;
+			}
+
+			for (size_t i = 0; i < names.size(); i++)
+			{
+				if (names[i] == name)
+				{
+					return i;
+				}
+			}
+
+			return std::string::npos;
+		}
+
+		template<Bound T>
+		size_t body_size(const T &obj);
+
+		template<Bound T>
+		char *write_body(char *out, const T &obj);
+
+		template<Bound T>
+		bool decode_body(const View &view, T &obj);
+
+		// one byte for the type and 4 for the length
+		constexpr size_t VALUE_HEADER = 5;
+
+		template<class M>
+		size_t value_size(const M &m)
+		{
+			if constexpr (std::is_same_v<M, bool>)
+				return VALUE_HEADER + 1;
+			else if constexpr (std::is_floating_point_v<M>)
+				return VALUE_HEADER + sizeof(double);
+			else if constexpr (std::is_arithmetic_v<M>)
+				return VALUE_HEADER + sizeof(M);
+			else if constexpr (std::is_same_v<M, std::string>)
+				return VALUE_HEADER + m.size();
+			else if constexpr (is_packable<M>)
+				// one byte for the element type
+				return VALUE_HEADER + 1 + m.size() * sizeof(m[0]);
+			else if constexpr (is_vector<M>::value)
+			{
+				size_t size = VALUE_HEADER;
+
+				for (const auto &e : m)
+				{
+					size += value_size(e);
+				}
+
+				return size;
+			}
+			else
+				// the body starts with the field count which takes the place of the length
+				return 1 + body_size(m);
+		}
+
+		template<class M>
+		char *write_value(char *out, const M &m)
+		{
+			out = put(out, (uint8_t)wire_type<M>());
+
+			if constexpr (std::is_same_v<M, bool>)
+			{
+				out = put(out, (uint32_t)1);
+				return put(out, (uint8_t)m);
+			}
+			else if constexpr (std::is_floating_point_v<M>)
+			{
+				out = put(out, (uint32_t)sizeof(double));
+				return put(out, (double)m);
+			}
+			else if constexpr (std::is_arithmetic_v<M>)
+			{
+				out = put(out, (uint32_t)sizeof(M));
+				return put(out, m);
+			}
+			else if constexpr (std::is_same_v<M, std::string>)
+			{
+				out = put(out, (uint32_t)m.size());
+				return put_bytes(out, m);
+			}
+			else if constexpr (is_packable<M>)
+			{
+				out = put(out, (uint32_t)m.size());
+				out = put(out, packed_element<M>());
+				return put_bytes(out, { (const char*)m.data(), m.size() * sizeof(m[0]) });
+			}
+			else if constexpr (is_vector<M>::value)
+			{
+				out = put(out, (uint32_t)m.size());
+
+				for (const auto &e : m)
+				{
+					out = write_value(out, e);
+				}
+
+				return out;
+			}
+			else
+				return write_body(out, m);
+		}
+
+		template<class M>
+		bool decode(const View &view, M &m)
+		{
+			if constexpr (is_optional<M>::value)
+			{
+				return decode(view, m.emplace());
+			}
+			else if constexpr (std::is_same_v<M, bool>)
+			{
+				auto opt = view.get<uint8_t>();
+				m = opt.value_or(0);
+				return opt.has_value();
+			}
+			else if constexpr (std::is_floating_point_v<M>)
+			{
+				auto opt = view.get<double>();
+				m = opt.value_or(0);
+				return opt.has_value();
+			}
+			else if constexpr (std::is_arithmetic_v<M>)
+			{
+				auto opt = view.get<M>();
+				m = opt.value_or(0);
+				return opt.has_value();
+			}
+			else if constexpr (std::is_same_v<M, std::string>)
+			{
+				auto opt = view.string();
+
+				if (!opt)
+				{
+					return false;
+				}
+
+				m = *opt;
+
+				return true;
+			}
+			else if constexpr (is_vector<M>::value)
+			{
+				if constexpr (is_packable<M>)
+				{
+					if (view.type() == PackedT)
+					{
+						auto opt = view.packed();
+
+						if (!opt || opt->index() != packed_element<M>())
+						{
+							return false;
+						}
+
+						m = std::move(std::get<M>(*opt));
+
+						return true;
+					}
+				}
+
+				// other vectors and unpacked arrays of numbers are read element by element
+				if (view.type() != ArrayT)
+				{
+					return false;
+				}
+
+				m.clear();
+				m.reserve(view.size());
+
+				for (const auto &[_, e] : view)
+				{
+					if (!decode(e, m.emplace_back()))
+					{
+						return false;
+					}
+				}
+
+				return m.size() == view.size();
+			}
+			else
+				return decode_body(view, m);
+		}
+
+		template<class M>
+		inline bool present(const M &m)
+		{
+			if constexpr (is_optional<M>::value)
+				return m.has_value();
+			else
+				return true;
+		}
+
+		template<class M>
+		inline const auto &unwrap(const M &m)
+		{
+			if constexpr (is_optional<M>::value)
+				return *m;
+			else
+				return m;
+		}
+
+		template<Bound T>
+		size_t body_size(const T &obj)
+		{
+			check_binding<T>();
+
+			// the field count
+			size_t size = 4;
+
+			std::apply([&](auto ...f)
+			{
+				((size += present(obj.*f.member) ? 2 + f.name.size() + value_size(unwrap(obj.*f.member)) : 0), ...);
+			}, Binding<T>::fields);
+
+			return size;
+		}
+
+		template<Bound T>
+		char *write_body(char *out, const T &obj)
+		{
+			uint32_t count = 0;
+
+			std::apply([&](auto ...f)
+			{
+				((count += present(obj.*f.member)), ...);
+			}, Binding<T>::fields);
+
+			out = put(out, count);
+
+			std::apply([&](auto ...f)
+			{
+				auto write_field = [&](auto f)
+				{
+					if (!present(obj.*f.member))
+					{
+						return;
+					}
+
+					out = put(out, (uint16_t)f.name.size());
+					out = put_bytes(out, f.name);
+					out = write_value(out, unwrap(obj.*f.member));
+				};
+
+				(write_field(f), ...);
+			}, Binding<T>::fields);
+
+			return out;
+		}
+
+		template<Bound T>
+		bool decode_body(const View &view, T &obj)
+		{
+			check_binding<T>();
+
+			if (view.type() != MapT)
+			{
+				return false;
+			}
+
+			uint64_t found = 0;
+			size_t hint = 0;
+			size_t entries = 0;
+
+			for (const auto &[key, value] : view)
+			{
+				entries++;
+
+				size_t index = find_field<T>(key, hint);
+
+				// unknown fields are skipped so older structs can read newer data
+				if (index == std::string::npos)
+				{
+					continue;
+				}
+
+				bool ok = visit_field<T>(index, [&](auto f)
+				{
+					return decode(value, obj.*f.member);
+				}, std::make_index_sequence<field_count<T>()>());
+
+				if (!ok)
+				{
+					return false;
+				}
+
+				found |= uint64_t(1) << index;
+				hint = index+1;
+			}
+
+			return entries == view.size() && (required_mask<T>() & ~found) == 0;
+		}
+	}
+
+	template<Bound T>
+	size_t serialized_size(const T &obj)
+	{
+		// one byte for the data type and one for endianness
+		return 2 + bind::body_size(obj);
+	}
+
+	template<Bound T>
+	size_t serialize_into(const T &obj, char *out)
+	{
+		char *start = out;
+
+		// data type (key value pairs)
+		*out++ = 1;
+		*out++ = machine_endian();
+
+		return bind::write_body(out, obj) - start;
+	}
+
+	template<Bound T>
+	std::string serialize(const T &obj)
+	{
+		std::string buff;
+
+		buff.resize(serialized_size(obj));
+
+		serialize_into(obj, buff.data());
+
+		return buff;
+	}
+
+	// decodes a bound struct. fails if a required field is missing or any field has the wrong type
+	template<Bound T>
+	std::optional<T> deserialize(std::string_view buff)
+	{
+		auto view = View::from(buff);
+
+		if (!view)
+		{
+			return std::nullopt;
+		}
+
+		T obj{};
+
+		if (!bind::decode_body(*view, obj))
+		{
+			return std::nullopt;
+		}
+
+		return obj;
+	}
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+// byte level helpers shared by the asf implementation files
+
+#include "asf.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// one byte for the type, 4 for the size.
+// a serialized value should always be more than this
+constexpr int VALUE_HEADER_SIZE = 5;
+// one byte is for type (1 key value, 2 single value) and one byte for endianness
+constexpr int HEADER_SIZE = 2;
+
+// writes a number to out and returns the position after it
+template<class T>
+inline char *put(char *out, T n)
+{
+	std::memcpy(out, &n, sizeof(T));
+	return out + sizeof(T);
+}
+
+inline char *put_bytes(char *out, std::string_view bytes)
+{
+	// the data of an empty container can be null
+	if (!bytes.empty())
+	{
+		std::memcpy(out, bytes.data(), bytes.size());
+	}
+
+	return out + bytes.size();
+}
+
+template<class T>
+T read_to(std::string_view buff, bool should_reverse = false)
+{
+	T n;
+
+	auto *bytes = (char*)&n;
+
+	for (size_t i = 0; i < sizeof(T); i++)
+	{
+		bytes[i] = buff[i];
+	}
+
+	if (should_reverse)
+	{
+		std::reverse(bytes, bytes+sizeof(T));
+	}
+
+	n = *(T*)bytes;
+
+	return n;
+}
+
+// reverses the bytes of every element of an array in place.
+// the loops are kept simple so the compiler turns them into vector shuffles
+inline void reverse_elements(char *data, size_t count, size_t width)
+{
+	switch (width)
+	{
+		case 2:
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				uint16_t n;
+				std::memcpy(&n, data + i*2, 2);
+				n = __builtin_bswap16(n);
+				std::memcpy(data + i*2, &n, 2);
+			}
+
+			break;
+		}
+		case 4:
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				uint32_t n;
+				std::memcpy(&n, data + i*4, 4);
+				n = __builtin_bswap32(n);
+				std::memcpy(data + i*4, &n, 4);
+			}
+
+			break;
+		}
+		case 8:
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				uint64_t n;
+				std::memcpy(&n, data + i*8, 8);
+				n = __builtin_bswap64(n);
+				std::memcpy(data + i*8, &n, 8);
+			}
+
+			break;
+		}
+	}
+}
+
+// the size of an element of a packed array or 0 if the element type is unknown
+inline size_t packed_element_size(uint8_t element_type)
+{
+	constexpr uint8_t sizes[] { 1, 1, 2, 2, 4, 4, 8, 8, sizeof(float), sizeof(double) };
+
+	return element_type < std::size(sizes) ? sizes[element_type] : 0;
+}
+
+// copies count elements of a packed array out of buff. fails if the element type is unknown or buff is too short
+std::optional<ambry::PackedArray> read_packed(std::string_view buff, uint8_t element_type, uint64_t count, bool should_reverse);
+
+/*
+	v2 helpers. v2 data is always little endian and has no endianness byte,
+	the second byte of its header holds flags instead
+*/
+
+constexpr uint8_t V2_MAP = 3;
+constexpr uint8_t V2_SINGLE = 4;
+
+// maps carry a sorted offset table and containers carry their body size
+constexpr uint8_t V2_TABLES = 1;
+
+// the low nibble of a tag holds small lengths and integers inline. this value means a varint follows the tag instead
+constexpr uint8_t V2_EXTENDED = 15;
+
+// maps with fewer entries than this get no offset table since a linear scan of sorted keys is just as fast
+constexpr uint64_t V2_MIN_TABLE_ENTRIES = 8;
+
+inline size_t varint_size(uint64_t n)
+{
+	size_t size = 1;
+
+	while (n >= 0x80)
+	{
+		n >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+inline char *put_varint(char *out, uint64_t n)
+{
+	while (n >= 0x80)
+	{
+		*out++ = char(n | 0x80);
+		n >>= 7;
+	}
+
+	*out++ = char(n);
+
+	return out;
+}
+
+// reads a varint from the front of buff. returns the number of bytes read or 0 if its malformed
+inline size_t read_varint(std::string_view buff, uint64_t &out)
+{
+	out = 0;
+
+	for (size_t i = 0; i < buff.size() && i < 10; i++)
+	{
+		uint8_t byte = buff[i];
+
+		out |= uint64_t(byte & 0x7f) << (7 * i);
+
+		if (!(byte & 0x80))
+		{
+			return i+1;
+		}
+	}
+
+	return 0;
+}
+
+inline uint64_t zigzag(int64_t n)
+{
+	return (uint64_t(n) << 1) ^ uint64_t(n >> 63);
+}
+
+inline int64_t unzigzag(uint64_t n)
+{
+	return int64_t(n >> 1) ^ -int64_t(n & 1);
+}
+
+// the width in bytes of the entries of an offset table for a map whose entries take up size bytes
+inline size_t offset_width(uint64_t size)
+{
+	return size <= 0xff ? 1 : size <= 0xffff ? 2 : 4;
+}
+
+// writes the low bytes of n in little endian order
+inline char *put_le(char *out, uint64_t n, size_t width)
+{
+	for (size_t i = 0; i < width; i++)
+	{
+		*out++ = char(n >> (8 * i));
+	}
+
+	return out;
+}
+
+inline uint64_t read_le(std::string_view buff, size_t width)
+{
+	uint64_t n = 0;
+
+	for (size_t i = 0; i < width; i++)
+	{
+		n |= uint64_t(uint8_t(buff[i])) << (8 * i);
+	}
+
+	return n;
+}
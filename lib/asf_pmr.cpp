@@ -0,0 +1,233 @@
+#include "asf_pmr.hpp"
+#include "asf_common.hpp"
+#include "asf_view.hpp"
+
+#include <algorithm>
+
+/*
+	decoding walks a View so v1 and v2 data are both handled and every read is bounds checked.
+	limit is the size of the whole buffer. every element takes at least a byte so no container
+	can reserve more than that even if its header lies about its size
+*/
+
+bool decode_pmr(const ambry::View &view, ambry::pmr::Value &out, std::pmr::memory_resource *resource, size_t limit);
+
+bool decode_pmr_map(const ambry::View &view, ambry::pmr::Map &out, std::pmr::memory_resource *resource, size_t limit)
+{
+	out.reserve(std::min<size_t>(view.size(), limit));
+
+	size_t n = 0;
+
+	for (const auto &[k, v] : view)
+	{
+		auto [iter, _] = out.try_emplace(ambry::pmr::String(k, resource));
+
+		if (!decode_pmr(v, iter->second, resource, limit))
+		{
+			return false;
+		}
+
+		n++;
+	}
+
+	// iteration stops early on malformed data
+	return n == view.size();
+}
+
+bool decode_pmr(const ambry::View &view, ambry::pmr::Value &out, std::pmr::memory_resource *resource, size_t limit)
+{
+	using namespace ambry;
+
+#define SCALAR_CASE(t, T) \
+	case t: \
+	{ \
+		auto n = view.get<T>(); \
+		if (!n) return false; \
+		out = *n; \
+		return true; \
+	} \
+
+	switch (view.type())
+	{
+		SCALAR_CASE(I8, int8_t)
+		SCALAR_CASE(U8, uint8_t)
+		SCALAR_CASE(I16, int16_t)
+		SCALAR_CASE(U16, uint16_t)
+		SCALAR_CASE(I32, int32_t)
+		SCALAR_CASE(U32, uint32_t)
+		SCALAR_CASE(I64, int64_t)
+		SCALAR_CASE(U64, uint64_t)
+		SCALAR_CASE(Double, double)
+		case StringT:
+		{
+			auto str = view.string();
+
+			if (!str)
+			{
+				return false;
+			}
+
+			out.emplace<pmr::String>(*str, resource);
+
+			return true;
+		}
+		case ArrayT:
+		{
+			auto &arr = out.emplace<pmr::Array>(resource);
+
+			arr.reserve(std::min<size_t>(view.size(), limit));
+
+			for (const auto &[_, v] : view)
+			{
+				if (!decode_pmr(v, arr.emplace_back(), resource, limit))
+				{
+					return false;
+				}
+			}
+
+			return arr.size() == view.size();
+		}
+		case MapT:
+		{
+			return decode_pmr_map(view, out.emplace<pmr::Map>(resource), resource, limit);
+		}
+		case PackedT:
+		{
+			if (view.size() > limit)
+			{
+				return false;
+			}
+
+			auto packed = pmr::PackedArray::of(view.element_type(), view.size(), resource);
+
+			if (!packed || !view.packed_into(packed->data()))
+			{
+				return false;
+			}
+
+			out = std::move(*packed);
+
+			return true;
+		}
+		default: return false;
+	}
+
+#undef SCALAR_CASE
+}
+
+std::optional<ambry::pmr::PackedArray>
+ambry::pmr::PackedArray::of(uint8_t element_type, size_t count, std::pmr::memory_resource *resource)
+{
+#define ELEMENT_CASE(i) case i: return PackedArray(std::in_place_index<i>, count, resource);
+
+	switch (element_type)
+	{
+		ELEMENT_CASE(0)
+		ELEMENT_CASE(1)
+		ELEMENT_CASE(2)
+		ELEMENT_CASE(3)
+		ELEMENT_CASE(4)
+		ELEMENT_CASE(5)
+		ELEMENT_CASE(6)
+		ELEMENT_CASE(7)
+		ELEMENT_CASE(8)
+		ELEMENT_CASE(9)
+		default: return std::nullopt;
+	}
+
+#undef ELEMENT_CASE
+}
+
+std::optional<ambry::pmr::Map>
+ambry::pmr::deserialize(std::string_view buff, std::pmr::memory_resource *resource)
+{
+	auto view = View::from(buff);
+
+	if (!view || view->type() != MapT || !(is_map(buff) || buff[0] == V2_MAP))
+	{
+		return std::nullopt;
+	}
+
+	Map out(resource);
+
+	if (!decode_pmr_map(*view, out, resource, buff.size()))
+	{
+		return std::nullopt;
+	}
+
+	return out;
+}
+
+std::optional<ambry::pmr::Value>
+ambry::pmr::deserialize_value(std::string_view buff, std::pmr::memory_resource *resource)
+{
+	auto view = View::from(buff);
+
+	if (!view || is_map(buff) || buff[0] == V2_MAP)
+	{
+		return std::nullopt;
+	}
+
+	Value out;
+
+	if (!decode_pmr(*view, out, resource, buff.size()))
+	{
+		return std::nullopt;
+	}
+
+	return out;
+}
+
+ambry::Value ambry::pmr::to_value(const Value &value)
+{
+	return std::visit([](const auto &v) -> ambry::Value
+	{
+		using T = std::decay_t<decltype(v)>;
+
+		if constexpr (std::is_arithmetic_v<T>)
+		{
+			return v;
+		}
+		else if constexpr (std::is_same_v<T, String>)
+		{
+			return std::string(v);
+		}
+		else if constexpr (std::is_same_v<T, Array>)
+		{
+			ambry::Array out;
+
+			out.reserve(v.size());
+
+			for (const auto &element : v)
+			{
+				out.push_back(to_value(element));
+			}
+
+			ambry::Value result;
+			result.emplace<ArrayT>(std::move(out));
+
+			return result;
+		}
+		else if constexpr (std::is_same_v<T, Map>)
+		{
+			ambry::Map out;
+
+			out.reserve(v.size());
+
+			for (const auto &[key, field] : v)
+			{
+				out.emplace(key, to_value(field));
+			}
+
+			return ambry::Value(std::move(out));
+		}
+		else
+		{
+			auto out = ambry::PackedArray::of(v.index(), v.size());
+
+			put_bytes(out->data(), { v.data(), v.size() * v.element_size() });
+
+			return *out;
+		}
+	}, (const ValueBase&)value);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+	value trees whose strings, arrays, maps and packed arrays all allocate from a std::pmr::memory_resource.
+	decoding into a monotonic arena turns the allocation per node of a regular Map into a few large
+	allocations, and the whole tree is freed at once by releasing the arena instead of node by node
+*/
+
+#include "asf.hpp"
+
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ambry::pmr
+{
+	struct Value;
+
+	using String = std::pmr::string;
+	using Array = std::pmr::vector<Value>;
+	using Map = std::pmr::unordered_map<String, Value>;
+
+	using PackedBase = std::variant<
+	std::pmr::vector<int8_t>, std::pmr::vector<uint8_t>, std::pmr::vector<int16_t>, std::pmr::vector<uint16_t>,
+	std::pmr::vector<int32_t>, std::pmr::vector<uint32_t>, std::pmr::vector<int64_t>, std::pmr::vector<uint64_t>,
+	std::pmr::vector<float>, std::pmr::vector<double>>;
+
+	// the same as ambry::PackedArray but allocated from a memory resource
+	struct PackedArray : public PackedBase
+	{
+		using PackedBase::PackedBase;
+
+		static std::optional<PackedArray> of(uint8_t element_type, size_t count, std::pmr::memory_resource *resource);
+
+		inline size_t size() const
+		{
+			return std::visit([](const auto &vec) { return vec.size(); }, *this);
+		}
+
+		inline size_t element_size() const
+		{
+			return std::visit([](const auto &vec) { return sizeof(vec[0]); }, *this);
+		}
+
+		inline const char *data() const
+		{
+			return std::visit([](const auto &vec) { return (const char*)vec.data(); }, *this);
+		}
+
+		inline char *data()
+		{
+			return std::visit([](auto &vec) { return (char*)vec.data(); }, *this);
+		}
+	};
+
+	// the alternatives are in the same order as ambry::Value so index() can be compared against Type
+	using ValueBase = std::variant<
+	int8_t, uint8_t, int16_t, uint16_t, int32_t, uint32_t, int64_t, uint64_t, double,
+	String, Array, Map, PackedArray>;
+
+	/*
+		variants are not allocator aware so a value does not pass its resource on by itself.
+		containers have to be given the resource when they are put into a value
+	*/
+	struct Value : public ValueBase
+	{
+		using ValueBase::ValueBase;
+		using ValueBase::operator=;
+	};
+
+	// decodes v1 or v2 data. every allocation of the tree comes from resource, which has to outlive it
+	std::optional<Map> deserialize(std::string_view buff, std::pmr::memory_resource *resource);
+
+	std::optional<Value> deserialize_value(std::string_view buff, std::pmr::memory_resource *resource);
+
+	// copies a tree into regular heap allocated values
+	ambry::Value to_value(const Value &value);
+}
@@ -0,0 +1,408 @@
+#include "asf_stream.hpp"
+#include "asf_common.hpp"
+#include "util.hpp"
+
+namespace ambry
+{
+	size_t scalar_size(Type type);
+
+	bool StreamDecoder::take(std::string_view &chunk, size_t n, std::string_view &out)
+	{
+		// the common case where the bytes are all in the chunk needs no copy
+		if (m_pending.empty() && chunk.size() >= n)
+		{
+			out = chunk.substr(0, n);
+			chunk.remove_prefix(n);
+			return true;
+		}
+
+		size_t count = std::min(n - m_pending.size(), chunk.size());
+
+		m_pending.append(chunk.substr(0, count));
+		chunk.remove_prefix(count);
+
+		if (m_pending.size() < n)
+		{
+			return false;
+		}
+
+		out = m_pending;
+
+		return true;
+	}
+
+	void StreamDecoder::next_value()
+	{
+		m_pending.clear();
+
+		if (m_stack.empty())
+		{
+			m_status = Status::Done;
+			return;
+		}
+
+		Frame &frame = m_stack.back();
+
+		frame.left--;
+
+		m_state = frame.is_map ? State::KeyLength : State::ValueHeader;
+	}
+
+	bool StreamDecoder::finish_value()
+	{
+		while (!m_stack.empty() && m_stack.back().left == 0)
+		{
+			m_stack.pop_back();
+
+			if (!m_visitor.end())
+			{
+				return false;
+			}
+		}
+
+		next_value();
+
+		return true;
+	}
+
+	bool StreamDecoder::start_value(std::string_view header)
+	{
+		m_type = Type(header[0]);
+
+		auto len = read_to<uint32_t>(header.substr(1), m_reverse);
+
+		switch (m_type)
+		{
+			case StringT:
+			{
+				m_state = State::String;
+				m_need = len;
+				return true;
+			}
+			case ArrayT:
+			case MapT:
+			{
+				if (m_stack.size() == MAX_DEPTH)
+				{
+					m_status = Status::Malformed;
+					return false;
+				}
+
+				bool ok = m_type == MapT ? m_visitor.begin_map(len) : m_visitor.begin_array(len);
+
+				if (!ok)
+				{
+					return false;
+				}
+
+				m_stack.push_back({ m_type == MapT, len });
+
+				return finish_value();
+			}
+			case PackedT:
+			{
+				m_state = State::PackedType;
+				m_need = len;
+				return true;
+			}
+			default:
+			{
+				size_t size = scalar_size(m_type);
+
+				if (size == 0 || len != size)
+				{
+					m_status = Status::Malformed;
+					return false;
+				}
+
+				m_state = State::Scalar;
+
+				return true;
+			}
+		}
+	}
+
+	bool StreamDecoder::feed_string(std::string_view &chunk)
+	{
+		size_t count = std::min<uint64_t>(m_need, chunk.size());
+
+		// an empty string still gets its one event
+		if (count == 0 && m_need != 0)
+		{
+			return true;
+		}
+
+		m_need -= count;
+
+		if (!m_visitor.string(chunk.substr(0, count), m_need == 0))
+		{
+			return false;
+		}
+
+		chunk.remove_prefix(count);
+
+		return m_need != 0 || finish_value();
+	}
+
+	bool StreamDecoder::feed_packed(std::string_view &chunk)
+	{
+		std::string_view elements;
+
+		// an element split across chunks is put back together first
+		if (!m_pending.empty() || chunk.size() < m_width)
+		{
+			if (!take(chunk, m_width, elements))
+			{
+				return true;
+			}
+
+			m_scratch = elements;
+			m_pending.clear();
+
+			elements = m_scratch;
+		}
+		else
+		{
+			size_t count = std::min<uint64_t>(m_need, chunk.size() / m_width);
+
+			elements = chunk.substr(0, count * m_width);
+			chunk.remove_prefix(count * m_width);
+		}
+
+		if (m_reverse)
+		{
+			if (elements.data() != m_scratch.data())
+			{
+				m_scratch = elements;
+			}
+
+			reverse_elements(m_scratch.data(), elements.size() / m_width, m_width);
+
+			elements = m_scratch;
+		}
+
+		m_need -= elements.size() / m_width;
+
+		if (!m_visitor.packed(m_element, elements, m_need == 0))
+		{
+			return false;
+		}
+
+		return m_need != 0 || finish_value();
+	}
+
+	StreamDecoder::Status StreamDecoder::fail(Status status)
+	{
+		if (m_status == Status::NeedMore)
+		{
+			m_status = status;
+		}
+
+		return m_status;
+	}
+
+	StreamDecoder::Status StreamDecoder::feed(std::string_view chunk)
+	{
+		while (m_status == Status::NeedMore)
+		{
+			std::string_view bytes;
+
+			switch (m_state)
+			{
+				case State::Header:
+				{
+					if (!take(chunk, HEADER_SIZE, bytes))
+					{
+						return m_status;
+					}
+
+					if (bytes[0] != 1 && bytes[0] != 2)
+					{
+						return fail(Status::Malformed);
+					}
+
+					m_reverse = bytes[1] != machine_endian();
+					m_state = bytes[0] == 1 ? State::RootCount : State::ValueHeader;
+					m_pending.clear();
+
+					break;
+				}
+				case State::RootCount:
+				{
+					if (!take(chunk, 4, bytes))
+					{
+						return m_status;
+					}
+
+					auto len = read_to<uint32_t>(bytes, m_reverse);
+
+					if (!m_visitor.begin_map(len))
+					{
+						return fail(Status::Stopped);
+					}
+
+					m_stack.push_back({ true, len });
+
+					if (!finish_value())
+					{
+						return fail(Status::Stopped);
+					}
+
+					break;
+				}
+				case State::KeyLength:
+				{
+					if (!take(chunk, 2, bytes))
+					{
+						return m_status;
+					}
+
+					m_need = read_to<uint16_t>(bytes, m_reverse);
+					m_state = State::Key;
+					m_pending.clear();
+
+					break;
+				}
+				case State::Key:
+				{
+					if (!take(chunk, m_need, bytes))
+					{
+						return m_status;
+					}
+
+					if (!m_visitor.key(bytes))
+					{
+						return fail(Status::Stopped);
+					}
+
+					m_state = State::ValueHeader;
+					m_pending.clear();
+
+					break;
+				}
+				case State::ValueHeader:
+				{
+					if (!take(chunk, VALUE_HEADER_SIZE, bytes))
+					{
+						return m_status;
+					}
+
+					std::string header { bytes };
+
+					m_pending.clear();
+
+					if (!start_value(header))
+					{
+						return fail(Status::Stopped);
+					}
+
+					break;
+				}
+				case State::Scalar:
+				{
+					size_t size = scalar_size(m_type);
+
+					if (!take(chunk, size, bytes))
+					{
+						return m_status;
+					}
+
+				#define SCALAR_CASE(t, T) case t: value = read_to<T>(bytes, m_reverse); break;
+
+					Value value;
+
+					switch (m_type)
+					{
+						SCALAR_CASE(I8, int8_t)
+						SCALAR_CASE(U8, uint8_t)
+						SCALAR_CASE(I16, int16_t)
+						SCALAR_CASE(U16, uint16_t)
+						SCALAR_CASE(I32, int32_t)
+						SCALAR_CASE(U32, uint32_t)
+						SCALAR_CASE(I64, int64_t)
+						SCALAR_CASE(U64, uint64_t)
+						SCALAR_CASE(Double, double)
+						default: break;
+					}
+
+				#undef SCALAR_CASE
+
+					if (!m_visitor.scalar(value) || !finish_value())
+					{
+						return fail(Status::Stopped);
+					}
+
+					break;
+				}
+				case State::String:
+				{
+					if (chunk.empty() && m_need != 0)
+					{
+						return m_status;
+					}
+
+					if (!feed_string(chunk))
+					{
+						return fail(Status::Stopped);
+					}
+
+					break;
+				}
+				case State::PackedType:
+				{
+					if (!take(chunk, 1, bytes))
+					{
+						return m_status;
+					}
+
+					m_element = bytes[0];
+					m_width = packed_element_size(m_element);
+					m_pending.clear();
+
+					if (m_width == 0)
+					{
+						return fail(Status::Malformed);
+					}
+
+					m_state = State::Packed;
+
+					// an empty array still gets its one event
+					if (m_need == 0)
+					{
+						if (!m_visitor.packed(m_element, {}, true) || !finish_value())
+						{
+							return fail(Status::Stopped);
+						}
+					}
+
+					break;
+				}
+				case State::Packed:
+				{
+					if (chunk.empty())
+					{
+						return m_status;
+					}
+
+					if (!feed_packed(chunk))
+					{
+						return fail(Status::Stopped);
+					}
+
+					break;
+				}
+			}
+		}
+
+		return m_status;
+	}
+
+	void StreamDecoder::reset()
+	{
+		m_status = Status::NeedMore;
+		m_state = State::Header;
+		m_stack.clear();
+		m_pending.clear();
+		m_need = 2;
+	}
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+/*
+	an incremental decoder for serialized data that is too big to hold in memory at once.
+	data is fed in chunks of any size and the decoder reports what it reads to a visitor as it goes.
+	it only ever buffers a value header or a map key, strings and packed arrays are passed on in pieces.
+	only the v1 format is supported
+*/
+
+#include "asf.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ambry
+{
+	// receives the events of a StreamDecoder. returning false from any of them stops decoding
+	class Visitor
+	{
+	public:
+		virtual ~Visitor() = default;
+
+		virtual bool begin_map(uint32_t size) { return true; }
+
+		virtual bool begin_array(uint32_t size) { return true; }
+
+		// ends the innermost map or array
+		virtual bool end() { return true; }
+
+		// the key of the next value in a map
+		virtual bool key(std::string_view key) { return true; }
+
+		// any arithmetic value
+		virtual bool scalar(const Value &value) { return true; }
+
+		// called one or more times for every string. last is set on the final piece
+		virtual bool string(std::string_view part, bool last) { return true; }
+
+		// called one or more times for every packed array with whole elements in the machines byte order
+		virtual bool packed(uint8_t element_type, std::string_view elements, bool last) { return true; }
+	};
+
+	class StreamDecoder
+	{
+	public:
+		enum class Status : uint8_t
+		{
+			// the data so far is valid but incomplete
+			NeedMore,
+			// a whole value has been decoded. anything fed after it is ignored
+			Done,
+			// the visitor returned false
+			Stopped,
+			Malformed,
+		};
+
+		// containers nested deeper than this are treated as malformed so memory use stays bounded
+		static constexpr size_t MAX_DEPTH = 512;
+
+		explicit StreamDecoder(Visitor &visitor) :
+			m_visitor(visitor)
+		{}
+
+		Status feed(std::string_view chunk);
+
+		inline Status status() const
+		{
+			return m_status;
+		}
+
+		// starts over at the beginning of a new buffer
+		void reset();
+
+	private:
+		enum class State : uint8_t
+		{
+			Header,
+			RootCount,
+			KeyLength,
+			Key,
+			ValueHeader,
+			Scalar,
+			String,
+			PackedType,
+			Packed,
+		};
+
+		struct Frame
+		{
+			bool is_map;
+			// values that have not been started yet
+			uint32_t left;
+		};
+
+		Visitor &m_visitor;
+		Status m_status = Status::NeedMore;
+		State m_state = State::Header;
+		bool m_reverse = false;
+		std::vector<Frame> m_stack;
+
+		// bytes of a header or key that was split across chunks
+		std::string m_pending;
+		// how many bytes the current state needs or has left to pass on
+		uint64_t m_need = 2;
+
+		Type m_type = AnyT;
+		uint8_t m_element = 0;
+		size_t m_width = 0;
+		// elements are byte swapped here when the data has a different endianness
+		std::string m_scratch;
+
+		// returns the next n bytes once they are all available. they may point into the chunk or m_pending
+		bool take(std::string_view &chunk, size_t n, std::string_view &out);
+
+		// decides what comes next after a value has been read or a container was started
+		void next_value();
+
+		// closes every finished container
+		bool finish_value();
+
+		bool start_value(std::string_view header);
+
+		bool feed_string(std::string_view &chunk);
+
+		bool feed_packed(std::string_view &chunk);
+
+		Status fail(Status status);
+	};
+}
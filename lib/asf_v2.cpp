@@ -0,0 +1,627 @@
+#include "asf_v2.hpp"
+#include "asf_common.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/*
+	like v1 encoding is done in two passes. the measuring pass records the body size of every container
+	and the sorted entries of every map in the order the writing pass will visit them,
+	so neither has to be worked out twice
+*/
+
+using Entry = ambry::Map::value_type;
+
+// the size of a tag along with its extended varint if the number does not fit inline
+size_t tagged_size(uint64_t n)
+{
+	return 1 + (n >= V2_EXTENDED ? varint_size(n) : 0);
+}
+
+char *put_tagged(char *out, ambry::Type type, uint64_t n)
+{
+	if (n < V2_EXTENDED)
+	{
+		*out++ = char((type << 4) | n);
+		return out;
+	}
+
+	*out++ = char((type << 4) | V2_EXTENDED);
+
+	return put_varint(out, n);
+}
+
+struct Encoder
+{
+	bool tables;
+
+	std::vector<uint64_t> sizes;
+	std::vector<const Entry*> entries;
+
+	size_t next_size = 0;
+	size_t next_entry = 0;
+
+	size_t measure(const ambry::Value &value);
+	size_t measure_map(const ambry::Map &map);
+
+	char *write(char *out, const ambry::Value &value);
+	char *write_map(char *out, const ambry::Map &map);
+};
+
+size_t table_size(uint64_t count, uint64_t body)
+{
+	return count >= V2_MIN_TABLE_ENTRIES ? count * offset_width(body) : 0;
+}
+
+size_t Encoder::measure_map(const ambry::Map &map)
+{
+	size_t first = entries.size();
+
+	for (const auto &entry : map)
+	{
+		entries.push_back(&entry);
+	}
+
+	std::sort(entries.begin() + first, entries.end(), [](const Entry *a, const Entry *b)
+	{
+		return a->first < b->first;
+	});
+
+	size_t slot = sizes.size();
+
+	if (tables)
+	{
+		sizes.push_back(0);
+	}
+
+	uint64_t body = 0;
+
+	// entries can grow while measuring nested maps so it is indexed instead of iterated
+	for (size_t i = first; i < first + map.size(); i++)
+	{
+		const auto &[key, value] = *entries[i];
+
+		body += varint_size(key.size()) + key.size() + measure(value);
+	}
+
+	size_t size = tagged_size(map.size()) + body;
+
+	if (tables)
+	{
+		sizes[slot] = body;
+		size += varint_size(body) + table_size(map.size(), body);
+	}
+
+	return size;
+}
+
+size_t Encoder::measure(const ambry::Value &value)
+{
+	using namespace ambry;
+
+#define UNSIGNED_CASE(t) case t: return tagged_size(std::get<t>(value));
+#define SIGNED_CASE(t) case t: return tagged_size(zigzag(std::get<t>(value)));
+
+	switch (value.index())
+	{
+		SIGNED_CASE(I8)
+		UNSIGNED_CASE(U8)
+		SIGNED_CASE(I16)
+		UNSIGNED_CASE(U16)
+		SIGNED_CASE(I32)
+		UNSIGNED_CASE(U32)
+		SIGNED_CASE(I64)
+		UNSIGNED_CASE(U64)
+		case Double: return 1 + sizeof(double);
+		case StringT:
+		{
+			size_t len = std::get<StringT>(value).size();
+			return tagged_size(len) + len;
+		}
+		case ArrayT:
+		{
+			const auto &vec = std::get<ArrayT>(value);
+
+			size_t slot = sizes.size();
+
+			if (tables)
+			{
+				sizes.push_back(0);
+			}
+
+			uint64_t body = 0;
+
+			for (const auto &val : vec)
+			{
+				body += measure(val);
+			}
+
+			size_t size = tagged_size(vec.size()) + body;
+
+			if (tables)
+			{
+				sizes[slot] = body;
+				size += varint_size(body);
+			}
+
+			return size;
+		}
+		case MapT:
+		{
+			return measure_map(std::get<MapT>(value));
+		}
+		case PackedT:
+		{
+			const auto &packed = std::get<PackedT>(value);
+
+			// one byte for the element type
+			return tagged_size(packed.size()) + 1 + packed.size() * packed.element_size();
+		}
+	}
+
+	return 0;
+
+#undef UNSIGNED_CASE
+#undef SIGNED_CASE
+}
+
+char *Encoder::write_map(char *out, const ambry::Map &map)
+{
+	size_t first = next_entry;
+
+	next_entry += map.size();
+
+	out = put_tagged(out, ambry::MapT, map.size());
+
+	char *table = nullptr;
+	size_t width = 0;
+
+	if (tables)
+	{
+		uint64_t body = sizes[next_size++];
+
+		out = put_varint(out, body);
+
+		if (map.size() >= V2_MIN_TABLE_ENTRIES)
+		{
+			table = out;
+			width = offset_width(body);
+			out += map.size() * width;
+		}
+	}
+
+	char *start = out;
+
+	for (size_t i = 0; i < map.size(); i++)
+	{
+		const auto &[key, value] = *entries[first + i];
+
+		if (table)
+		{
+			put_le(table + i * width, out - start, width);
+		}
+
+		out = put_varint(out, key.size());
+		out = put_bytes(out, key);
+		out = write(out, value);
+	}
+
+	return out;
+}
+
+char *Encoder::write(char *out, const ambry::Value &value)
+{
+	using namespace ambry;
+
+#define UNSIGNED_CASE(t) case t: return put_tagged(out, t, std::get<t>(value));
+#define SIGNED_CASE(t) case t: return put_tagged(out, t, zigzag(std::get<t>(value)));
+
+	switch (value.index())
+	{
+		SIGNED_CASE(I8)
+		UNSIGNED_CASE(U8)
+		SIGNED_CASE(I16)
+		UNSIGNED_CASE(U16)
+		SIGNED_CASE(I32)
+		UNSIGNED_CASE(U32)
+		SIGNED_CASE(I64)
+		UNSIGNED_CASE(U64)
+		case Double:
+		{
+			uint64_t bits;
+			double n = std::get<Double>(value);
+
+			std::memcpy(&bits, &n, sizeof(n));
+
+			*out++ = char(Double << 4);
+
+			return put_le(out, bits, sizeof(bits));
+		}
+		case StringT:
+		{
+			const auto &str = std::get<StringT>(value);
+
+			out = put_tagged(out, StringT, str.size());
+
+			return put_bytes(out, str);
+		}
+		case ArrayT:
+		{
+			const auto &vec = std::get<ArrayT>(value);
+
+			out = put_tagged(out, ArrayT, vec.size());
+
+			if (tables)
+			{
+				out = put_varint(out, sizes[next_size++]);
+			}
+
+			for (const auto &val : vec)
+			{
+				out = write(out, val);
+			}
+
+			return out;
+		}
+		case MapT:
+		{
+			return write_map(out, std::get<MapT>(value));
+		}
+		case PackedT:
+		{
+			const auto &packed = std::get<PackedT>(value);
+
+			out = put_tagged(out, PackedT, packed.size());
+			out = put(out, (uint8_t)packed.index());
+
+			char *start = out;
+
+			out = put_bytes(out, { packed.data(), packed.size() * packed.element_size() });
+
+			if (machine_endian() != 1)
+			{
+				reverse_elements(start, packed.size(), packed.element_size());
+			}
+
+			return out;
+		}
+	}
+
+	return out;
+
+#undef UNSIGNED_CASE
+#undef SIGNED_CASE
+}
+
+// decodes v2 values while checking every length against the buffer
+struct Decoder
+{
+	std::string_view buff;
+	bool tables;
+	size_t pos = 0;
+
+	bool varint(uint64_t &out)
+	{
+		size_t read = read_varint(buff.substr(pos), out);
+
+		pos += read;
+
+		return read != 0;
+	}
+
+	bool tag(ambry::Type &type, uint64_t &n)
+	{
+		if (pos >= buff.size())
+		{
+			return false;
+		}
+
+		uint8_t tag = buff[pos++];
+
+		type = ambry::Type(tag >> 4);
+		n = tag & 0xf;
+
+		if (type != ambry::Double && n == V2_EXTENDED)
+		{
+			return varint(n);
+		}
+
+		return true;
+	}
+
+	// takes size bytes from the buffer
+	bool take(uint64_t size, std::string_view &out)
+	{
+		if (buff.size() - pos < size)
+		{
+			return false;
+		}
+
+		out = buff.substr(pos, size);
+		pos += size;
+
+		return true;
+	}
+
+	std::optional<ambry::Value> value();
+
+	bool map(uint64_t count, ambry::Map &out);
+};
+
+bool Decoder::map(uint64_t count, ambry::Map &out)
+{
+	size_t end = buff.size();
+
+	// every entry takes at least two bytes so a count bigger then the data is malformed
+	if (count > end - pos)
+	{
+		return false;
+	}
+
+	if (tables)
+	{
+		uint64_t body;
+		std::string_view table;
+
+		if (!varint(body) || !take(table_size(count, body), table) || buff.size() - pos < body)
+		{
+			return false;
+		}
+
+		end = pos + body;
+	}
+
+	out.reserve(std::min<uint64_t>(count, end - pos));
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		uint64_t key_len;
+		std::string_view key;
+
+		if (!varint(key_len) || !take(key_len, key))
+		{
+			return false;
+		}
+
+		auto opt = value();
+
+		if (!opt)
+		{
+			return false;
+		}
+
+		out.emplace(key, std::move(*opt));
+	}
+
+	return !tables || pos == end;
+}
+
+std::optional<ambry::Value> Decoder::value()
+{
+	using namespace ambry;
+
+	Type type;
+	uint64_t n;
+
+	if (!tag(type, n))
+	{
+		return std::nullopt;
+	}
+
+#define UNSIGNED_CASE(t, T) \
+	case t: \
+	{ \
+		if (n > std::numeric_limits<T>::max()) return std::nullopt; \
+		return Value(T(n)); \
+	} \
+
+#define SIGNED_CASE(t, T) \
+	case t: \
+	{ \
+		int64_t s = unzigzag(n); \
+		if (s < std::numeric_limits<T>::min() || s > std::numeric_limits<T>::max()) return std::nullopt; \
+		return Value(T(s)); \
+	} \
+
+	switch (type)
+	{
+		SIGNED_CASE(I8, int8_t)
+		UNSIGNED_CASE(U8, uint8_t)
+		SIGNED_CASE(I16, int16_t)
+		UNSIGNED_CASE(U16, uint16_t)
+		SIGNED_CASE(I32, int32_t)
+		UNSIGNED_CASE(U32, uint32_t)
+		SIGNED_CASE(I64, int64_t)
+		UNSIGNED_CASE(U64, uint64_t)
+		case Double:
+		{
+			std::string_view bytes;
+
+			if (!take(sizeof(double), bytes))
+			{
+				return std::nullopt;
+			}
+
+			uint64_t bits = read_le(bytes, sizeof(bits));
+			double d;
+
+			std::memcpy(&d, &bits, sizeof(d));
+
+			return Value(d);
+		}
+		case StringT:
+		{
+			std::string_view str;
+
+			if (!take(n, str))
+			{
+				return std::nullopt;
+			}
+
+			return Value(std::string{ str });
+		}
+		case ArrayT:
+		{
+			size_t end = buff.size();
+
+			if (tables)
+			{
+				uint64_t body;
+
+				if (!varint(body) || buff.size() - pos < body)
+				{
+					return std::nullopt;
+				}
+
+				end = pos + body;
+			}
+
+			Array out;
+
+			// every element takes at least one byte so a count bigger then the data is malformed
+			if (n > end - pos)
+			{
+				return std::nullopt;
+			}
+
+			out.reserve(n);
+
+			for (uint64_t i = 0; i < n; i++)
+			{
+				auto opt = value();
+
+				if (!opt)
+				{
+					return std::nullopt;
+				}
+
+				out.emplace_back(std::move(*opt));
+			}
+
+			if (tables && pos != end)
+			{
+				return std::nullopt;
+			}
+
+			return Value(std::move(out));
+		}
+		case MapT:
+		{
+			Map out;
+
+			if (!map(n, out))
+			{
+				return std::nullopt;
+			}
+
+			return Value(std::move(out));
+		}
+		case PackedT:
+		{
+			std::string_view element_type;
+
+			if (!take(1, element_type))
+			{
+				return std::nullopt;
+			}
+
+			auto packed = read_packed(buff.substr(pos), element_type[0], n, machine_endian() != 1);
+
+			if (!packed)
+			{
+				return std::nullopt;
+			}
+
+			pos += packed->size() * packed->element_size();
+
+			return Value(std::move(*packed));
+		}
+		default: return std::nullopt;
+	}
+
+#undef UNSIGNED_CASE
+#undef SIGNED_CASE
+}
+
+void ambry::serialize_v2(const Map &map, std::string &buff, V2Options opts)
+{
+	Encoder encoder { opts.offset_tables };
+
+	size_t size = HEADER_SIZE + encoder.measure_map(map);
+	size_t offset = buff.size();
+
+	buff.resize(offset + size);
+
+	char *out = buff.data() + offset;
+
+	*out++ = V2_MAP;
+	*out++ = opts.offset_tables ? V2_TABLES : 0;
+
+	encoder.write_map(out, map);
+}
+
+std::string ambry::serialize_v2(const Map &map, V2Options opts)
+{
+	std::string buff;
+
+	serialize_v2(map, buff, opts);
+
+	return buff;
+}
+
+std::string ambry::serialize_value_v2(const Value &value, V2Options opts)
+{
+	Encoder encoder { opts.offset_tables };
+
+	std::string buff;
+
+	buff.resize(HEADER_SIZE + encoder.measure(value));
+
+	buff[0] = V2_SINGLE;
+	buff[1] = opts.offset_tables ? V2_TABLES : 0;
+
+	encoder.write(buff.data() + HEADER_SIZE, value);
+
+	return buff;
+}
+
+bool ambry::is_v2(std::string_view buff)
+{
+	return buff.size() > HEADER_SIZE && (buff[0] == V2_MAP || buff[0] == V2_SINGLE);
+}
+
+std::optional<ambry::Map> ambry::deserialize_v2(std::string_view buff)
+{
+	if (!is_v2(buff) || buff[0] != V2_MAP)
+	{
+		return std::nullopt;
+	}
+
+	Decoder decoder { buff.substr(HEADER_SIZE), bool(buff[1] & V2_TABLES) };
+
+	Type type;
+	uint64_t count;
+
+	Map out;
+
+	if (!decoder.tag(type, count) || type != MapT || !decoder.map(count, out))
+	{
+		return std::nullopt;
+	}
+
+	return out;
+}
+
+std::optional<ambry::Value> ambry::deserialize_value_v2(std::string_view buff)
+{
+	if (!is_v2(buff) || buff[0] != V2_SINGLE)
+	{
+		return std::nullopt;
+	}
+
+	Decoder decoder { buff.substr(HEADER_SIZE), bool(buff[1] & V2_TABLES) };
+
+	return decoder.value();
+}
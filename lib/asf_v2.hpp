@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+	version 2 of the serialization format. it is opt in, data written with it
+	is read by the normal deserialize functions and by View
+
+	every value starts with a one byte tag. the high nibble is the type and the low nibble holds
+	an integer, string length or element count below 15 inline. 15 means a varint follows the tag.
+	signed integers are zigzag encoded so small negative numbers stay small. doubles are 8 little endian bytes.
+	map keys are prefixed by a varint length and are always written in sorted order.
+
+	with offset tables enabled every container also carries its body size so it can be skipped without decoding it,
+	and maps with enough entries carry a table of entry offsets so a field is found with a binary search
+*/
+
+#include "asf.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace ambry
+{
+	struct V2Options
+	{
+		bool offset_tables = true;
+	};
+
+	std::string serialize_v2(const Map &map, V2Options opts = {});
+
+	// serializes a map onto the end of buff
+	void serialize_v2(const Map &map, std::string &buff, V2Options opts = {});
+
+	std::string serialize_value_v2(const Value &value, V2Options opts = {});
+
+	std::optional<Map> deserialize_v2(std::string_view buff);
+
+	std::optional<Value> deserialize_value_v2(std::string_view buff);
+
+	// determines if serialized data uses the v2 format
+	bool is_v2(std::string_view buff);
+}
@@ -0,0 +1,784 @@
+#include "asf_view.hpp"
+#include "asf_common.hpp"
+#include "util.hpp"
+
+#include <cstring>
+
+namespace ambry
+{
+	// the size of an arithmetic type or 0 if its not arithmetic
+	size_t scalar_size(Type type)
+	{
+		switch (type)
+		{
+			case I8: case U8:   return 1;
+			case I16: case U16: return 2;
+			case I32: case U32: return 4;
+			case I64: case U64: case Double: return 8;
+			default: return 0;
+		}
+	}
+
+	std::optional<View> View::from(std::string_view buff)
+	{
+		if (buff.size() <= HEADER_SIZE)
+		{
+			return std::nullopt;
+		}
+
+		if (buff[0] == V2_MAP || buff[0] == V2_SINGLE)
+		{
+			auto view = parse_v2(buff.substr(HEADER_SIZE), buff[1] & V2_TABLES, 0);
+
+			if (view && buff[0] == V2_MAP && view->m_type != MapT)
+			{
+				return std::nullopt;
+			}
+
+			return view;
+		}
+
+		bool reverse = buff[1] != machine_endian();
+
+		if (is_single(buff))
+		{
+			return parse(buff.substr(HEADER_SIZE), reverse, 0);
+		}
+
+		if (!is_map(buff) || buff.size() < HEADER_SIZE + 4)
+		{
+			return std::nullopt;
+		}
+
+		View view;
+
+		view.m_type = MapT;
+		view.m_len = read_to<uint32_t>(buff.substr(HEADER_SIZE), reverse);
+		view.m_body = buff.substr(HEADER_SIZE + 4);
+		view.m_start = buff;
+		view.m_reverse = reverse;
+
+		return view;
+	}
+
+	std::optional<View> View::parse(std::string_view buff, bool reverse, uint16_t depth)
+	{
+		if (buff.size() < VALUE_HEADER_SIZE)
+		{
+			return std::nullopt;
+		}
+
+		View view;
+
+		view.m_depth = depth;
+		view.m_type = Type(buff[0]);
+		view.m_len = read_to<uint32_t>(buff.substr(1), reverse);
+		view.m_body = buff.substr(VALUE_HEADER_SIZE);
+		view.m_start = buff;
+		view.m_reverse = reverse;
+
+		switch (view.m_type)
+		{
+			case StringT:
+			{
+				if (view.m_body.size() < view.m_len)
+				{
+					return std::nullopt;
+				}
+
+				view.m_body = view.m_body.substr(0, view.m_len);
+
+				break;
+			}
+			case ArrayT:
+			case MapT:
+			{
+				// v1 containers have no byte length so their size is found by walking every level below them
+				if (depth > MAX_DEPTH)
+				{
+					return std::nullopt;
+				}
+
+				break;
+			}
+			case PackedT:
+			{
+				if (!view.read_packed_header(view.m_body))
+				{
+					return std::nullopt;
+				}
+
+				break;
+			}
+			default:
+			{
+				size_t size = scalar_size(view.m_type);
+
+				if (size == 0 || view.m_len != size || view.m_body.size() < size)
+				{
+					return std::nullopt;
+				}
+
+				view.m_body = view.m_body.substr(0, size);
+			}
+		}
+
+		return view;
+	}
+
+	std::optional<View> View::parse_v2(std::string_view buff, bool tables, uint16_t depth)
+	{
+		if (buff.empty())
+		{
+			return std::nullopt;
+		}
+
+		View view;
+
+		view.m_depth = depth;
+
+		uint8_t tag = buff[0];
+		uint64_t n = tag & 0xf;
+		size_t pos = 1;
+
+		view.m_type = Type(tag >> 4);
+		view.m_start = buff;
+		view.m_v2 = true;
+		view.m_tables = tables;
+		// doubles are the only fixed width values and v2 always stores them little endian
+		view.m_reverse = machine_endian() != 1;
+
+		if (view.m_type != Double && n == V2_EXTENDED)
+		{
+			size_t read = read_varint(buff.substr(pos), n);
+
+			if (read == 0)
+			{
+				return std::nullopt;
+			}
+
+			pos += read;
+		}
+
+		switch (view.m_type)
+		{
+			case Double:
+			{
+				if (buff.size() - pos < sizeof(double))
+				{
+					return std::nullopt;
+				}
+
+				view.m_len = sizeof(double);
+				view.m_body = buff.substr(pos, sizeof(double));
+
+				break;
+			}
+			case StringT:
+			{
+				if (buff.size() - pos < n)
+				{
+					return std::nullopt;
+				}
+
+				view.m_len = n;
+				view.m_body = buff.substr(pos, n);
+
+				break;
+			}
+			case ArrayT:
+			case MapT:
+			{
+				if (n > UINT32_MAX || depth > MAX_DEPTH)
+				{
+					return std::nullopt;
+				}
+
+				view.m_len = n;
+
+				if (!tables)
+				{
+					view.m_body = buff.substr(pos);
+					break;
+				}
+
+				uint64_t body;
+				size_t read = read_varint(buff.substr(pos), body);
+
+				if (read == 0)
+				{
+					return std::nullopt;
+				}
+
+				pos += read;
+
+				size_t table = view.m_type == MapT && n >= V2_MIN_TABLE_ENTRIES ? n * offset_width(body) : 0;
+
+				if (buff.size() - pos < table || buff.size() - pos - table < body)
+				{
+					return std::nullopt;
+				}
+
+				view.m_table = buff.substr(pos, table);
+				view.m_body = buff.substr(pos + table, body);
+
+				break;
+			}
+			case PackedT:
+			{
+				if (n > UINT32_MAX)
+				{
+					return std::nullopt;
+				}
+
+				view.m_len = n;
+
+				if (!view.read_packed_header(buff.substr(pos)))
+				{
+					return std::nullopt;
+				}
+
+				break;
+			}
+			default:
+			{
+				size_t size = scalar_size(view.m_type);
+
+				if (size == 0)
+				{
+					return std::nullopt;
+				}
+
+				view.m_len = size;
+				view.m_int = n;
+				view.m_body = buff.substr(pos, 0);
+			}
+		}
+
+		return view;
+	}
+
+	bool View::read_packed_header(std::string_view buff)
+	{
+		if (buff.empty())
+		{
+			return false;
+		}
+
+		m_element = buff[0];
+
+		size_t width = packed_element_size(m_element);
+
+		if (width == 0 || m_len > (buff.size() - 1) / width)
+		{
+			return false;
+		}
+
+		m_body = buff.substr(1, m_len * width);
+
+		return true;
+	}
+
+	bool View::read_int_v2(void *out, size_t size) const
+	{
+		uint64_t bits = m_int;
+
+		// signed types have even values in the type enum
+		if (m_type % 2 == 0)
+		{
+			int64_t n = unzigzag(m_int);
+			int64_t max = size == 8 ? INT64_MAX : (int64_t(1) << (8 * size - 1)) - 1;
+
+			if (n > max || n < -max - 1)
+			{
+				return false;
+			}
+
+			bits = n;
+		}
+		else if (size < 8 && (bits >> (8 * size)) != 0)
+		{
+			return false;
+		}
+
+		switch (size)
+		{
+			case 1: { uint8_t n = bits; std::memcpy(out, &n, 1); break; }
+			case 2: { uint16_t n = bits; std::memcpy(out, &n, 2); break; }
+			case 4: { uint32_t n = bits; std::memcpy(out, &n, 4); break; }
+			default: std::memcpy(out, &bits, 8);
+		}
+
+		return true;
+	}
+
+	bool View::read_scalar(Type type, void *out, size_t size) const
+	{
+		if (m_type == type && m_v2 && type != Double)
+		{
+			return read_int_v2(out, size);
+		}
+
+		if (m_type != type || m_body.size() < size)
+		{
+			return false;
+		}
+
+		std::memcpy(out, m_body.data(), size);
+
+		if (m_reverse)
+		{
+			std::reverse((char*)out, (char*)out + size);
+		}
+
+		return true;
+	}
+
+	std::optional<int64_t> View::integer() const
+	{
+	#define INTEGRAL_CASE(t, T) case t: return get<T>();
+
+		switch (m_type)
+		{
+			INTEGRAL_CASE(I8, int8_t)
+			INTEGRAL_CASE(U8, uint8_t)
+			INTEGRAL_CASE(I16, int16_t)
+			INTEGRAL_CASE(U16, uint16_t)
+			INTEGRAL_CASE(I32, int32_t)
+			INTEGRAL_CASE(U32, uint32_t)
+			INTEGRAL_CASE(I64, int64_t)
+			INTEGRAL_CASE(U64, uint64_t)
+			default: return std::nullopt;
+		}
+
+	#undef INTEGRAL_CASE
+	}
+
+	std::optional<double> View::number() const
+	{
+		if (m_type == Double)
+		{
+			return get<double>();
+		}
+
+		return integer();
+	}
+
+	std::optional<std::string_view> View::string() const
+	{
+		if (m_type != StringT)
+		{
+			return std::nullopt;
+		}
+
+		return m_body;
+	}
+
+	std::optional<PackedArray> View::packed() const
+	{
+		if (m_type != PackedT)
+		{
+			return std::nullopt;
+		}
+
+		return read_packed(m_body, m_element, m_len, m_reverse);
+	}
+
+	bool View::packed_into(char *out) const
+	{
+		size_t width = packed_element_size(m_element);
+
+		if (m_type != PackedT || width == 0 || m_len > m_body.size() / width)
+		{
+			return false;
+		}
+
+		put_bytes(out, m_body.substr(0, m_len * width));
+
+		if (m_reverse)
+		{
+			reverse_elements(out, m_len, width);
+		}
+
+		return true;
+	}
+
+	std::optional<View> View::find(std::string_view key) const
+	{
+		if (m_type != MapT)
+		{
+			return std::nullopt;
+		}
+
+		if (!m_table.empty())
+		{
+			return search(key);
+		}
+
+		for (const auto &[k, v] : *this)
+		{
+			if (k == key)
+			{
+				return v;
+			}
+
+			// v2 keys are sorted so the key can not come after a bigger one
+			if (m_v2 && k > key)
+			{
+				break;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	std::optional<View> View::search(std::string_view key) const
+	{
+		size_t width = m_table.size() / m_len;
+		size_t low = 0;
+		size_t high = m_len;
+
+		while (low < high)
+		{
+			size_t mid = (low + high) / 2;
+			uint64_t offset = read_le(m_table.substr(mid * width), width);
+
+			if (offset >= m_body.size())
+			{
+				return std::nullopt;
+			}
+
+			std::string_view entry = m_body.substr(offset);
+
+			uint64_t key_len;
+			size_t read = read_varint(entry, key_len);
+
+			if (read == 0 || entry.size() - read < key_len)
+			{
+				return std::nullopt;
+			}
+
+			std::string_view k = entry.substr(read, key_len);
+
+			if (k == key)
+			{
+				return parse_v2(entry.substr(read + key_len), m_tables, m_depth + 1);
+			}
+
+			if (k < key)
+			{
+				low = mid+1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	std::optional<View> View::find(std::initializer_list<std::string_view> path) const
+	{
+		View view = *this;
+
+		for (auto key : path)
+		{
+			auto opt = view.find(key);
+
+			if (!opt)
+			{
+				return std::nullopt;
+			}
+
+			view = *opt;
+		}
+
+		return view;
+	}
+
+	std::optional<View> View::at(size_t index) const
+	{
+		if (m_type != ArrayT || index >= m_len)
+		{
+			return std::nullopt;
+		}
+
+		auto iter = begin();
+
+		for (size_t i = 0; i < index && iter != end(); i++)
+		{
+			++iter;
+		}
+
+		if (iter == end())
+		{
+			return std::nullopt;
+		}
+
+		return iter->second;
+	}
+
+	std::optional<Value> View::value() const
+	{
+	#define INTEGRAL_CASE(t, T) \
+		case t: \
+		{ \
+			auto opt = get<T>(); \
+			if (!opt) return std::nullopt; \
+			return Value(*opt); \
+		} \
+
+		switch (m_type)
+		{
+			INTEGRAL_CASE(I8, int8_t)
+			INTEGRAL_CASE(U8, uint8_t)
+			INTEGRAL_CASE(I16, int16_t)
+			INTEGRAL_CASE(U16, uint16_t)
+			INTEGRAL_CASE(I32, int32_t)
+			INTEGRAL_CASE(U32, uint32_t)
+			INTEGRAL_CASE(I64, int64_t)
+			INTEGRAL_CASE(U64, uint64_t)
+			INTEGRAL_CASE(Double, double)
+			case StringT:
+			{
+				return Value(std::string{ m_body });
+			}
+			case ArrayT:
+			{
+				Array out;
+
+				// the header can claim more elements than the body has room for
+				out.reserve(std::min<size_t>(m_len, m_body.size()));
+
+				size_t n = 0;
+
+				for (const auto &[_, v] : *this)
+				{
+					auto opt = v.value();
+
+					if (!opt)
+					{
+						return std::nullopt;
+					}
+
+					out.emplace_back(std::move(*opt));
+					n++;
+				}
+
+				// iteration stops early on malformed data
+				if (n != m_len)
+				{
+					return std::nullopt;
+				}
+
+				return Value(std::move(out));
+			}
+			case MapT:
+			{
+				Map out;
+
+				out.reserve(std::min<size_t>(m_len, m_body.size()));
+
+				size_t n = 0;
+
+				for (const auto &[k, v] : *this)
+				{
+					auto opt = v.value();
+
+					if (!opt)
+					{
+						return std::nullopt;
+					}
+
+					out.emplace(k, std::move(*opt));
+					n++;
+				}
+
+				if (n != m_len)
+				{
+					return std::nullopt;
+				}
+
+				return Value(std::move(out));
+			}
+			case PackedT:
+			{
+				auto opt = packed();
+
+				if (!opt)
+				{
+					return std::nullopt;
+				}
+
+				return Value(std::move(*opt));
+			}
+			default: return std::nullopt;
+		}
+
+	#undef INTEGRAL_CASE
+	}
+
+	size_t View::body_size() const
+	{
+		// containers with a known size have a bounded body
+		if ((m_type != ArrayT && m_type != MapT) || m_tables)
+		{
+			return m_body.size();
+		}
+
+		size_t size = 0;
+		size_t n = 0;
+
+		Iterator iter(*this);
+
+		for (; iter != end(); ++iter, n++)
+		{
+			size_t value_size = iter.value_size();
+
+			if (value_size == std::string::npos)
+			{
+				return std::string::npos;
+			}
+
+			size += iter.m_prefix + value_size;
+		}
+
+		return n == m_len ? size : std::string::npos;
+	}
+
+	size_t View::encoded_size() const
+	{
+		size_t size = body_size();
+
+		if (size == std::string::npos)
+		{
+			return size;
+		}
+
+		return (m_body.data() - m_start.data()) + size;
+	}
+
+	std::string_view View::raw() const
+	{
+		size_t size = encoded_size();
+
+		if (size == std::string::npos)
+		{
+			return {};
+		}
+
+		return m_start.substr(0, size);
+	}
+
+	View::Iterator View::begin() const
+	{
+		if (m_type != ArrayT && m_type != MapT)
+		{
+			return end();
+		}
+
+		return Iterator(*this);
+	}
+
+	View::Iterator View::end() const
+	{
+		return Iterator();
+	}
+
+	View::Iterator::Iterator(const View &container) :
+		m_rest(container.m_body),
+		m_left(container.m_len),
+		m_map(container.m_type == MapT),
+		m_reverse(container.m_reverse),
+		m_v2(container.m_v2),
+		m_tables(container.m_tables),
+		m_depth(container.m_depth + 1)
+	{
+		if (m_left)
+		{
+			read_entry();
+		}
+	}
+
+	void View::Iterator::read_entry()
+	{
+		std::string_view key;
+
+		m_prefix = 0;
+		m_size = 0;
+
+		if (m_map && m_v2)
+		{
+			uint64_t key_len;
+			size_t read = read_varint(m_rest, key_len);
+
+			if (read == 0 || m_rest.size() - read < key_len)
+			{
+				m_left = 0;
+				return;
+			}
+
+			key = m_rest.substr(read, key_len);
+
+			m_prefix = read + key_len;
+		}
+		else if (m_map)
+		{
+			if (m_rest.size() < 2)
+			{
+				m_left = 0;
+				return;
+			}
+
+			auto key_len = read_to<uint16_t>(m_rest, m_reverse);
+
+			if (m_rest.size() < 2 + key_len)
+			{
+				m_left = 0;
+				return;
+			}
+
+			key = m_rest.substr(2, key_len);
+
+			m_prefix = 2 + key_len;
+		}
+
+		auto opt = m_v2 ? parse_v2(m_rest.substr(m_prefix), m_tables, m_depth) : parse(m_rest.substr(m_prefix), m_reverse, m_depth);
+
+		if (!opt)
+		{
+			m_left = 0;
+			return;
+		}
+
+		m_entry = { key, *opt };
+	}
+
+	size_t View::Iterator::value_size()
+	{
+		if (m_size == 0)
+		{
+			m_size = m_entry.second.encoded_size();
+		}
+
+		return m_size;
+	}
+
+	View::Iterator& View::Iterator::operator++()
+	{
+		size_t size = value_size();
+
+		if (size == std::string::npos || --m_left == 0)
+		{
+			m_left = 0;
+			return *this;
+		}
+
+		m_rest = m_rest.substr(m_prefix + size);
+
+		read_entry();
+
+		return *this;
+	}
+}
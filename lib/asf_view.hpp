@@ -0,0 +1,204 @@
+#pragma once
+
+// a lazy read only view over serialized asf data
+
+#include "asf.hpp"
+
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace ambry
+{
+	/*
+		a view never copies or allocates. it only reads the header of the value it points at,
+		fields and elements are found by skipping over the encoded data when they are asked for.
+		the buffer it was made from has to outlive it
+	*/
+	class View
+	{
+	public:
+		class Iterator;
+
+		View() = default;
+
+		// containers nested deeper than this are treated as malformed so walking them can not exhaust the stack
+		static constexpr size_t MAX_DEPTH = 512;
+
+		// views the root of serialized data. it can be either a map or a single value
+		static std::optional<View> from(std::string_view buff);
+
+		inline Type type() const
+		{
+			return m_type;
+		}
+
+		// the number of elements in an array, map or packed array or the length of a string
+		inline uint32_t size() const
+		{
+			return m_len;
+		}
+
+		// reads an arithmetic value. the type has to match exactly
+		template<class T>
+		std::optional<T> get() const
+		{
+			static_assert(std::is_arithmetic_v<T>, "T is not an arithmetic type");
+
+			T n;
+
+			if (!read_scalar(type_of<T>(), &n, sizeof(T)))
+			{
+				return std::nullopt;
+			}
+
+			return n;
+		}
+
+		// reads any integer type as an int64_t
+		std::optional<int64_t> integer() const;
+
+		// reads any numeric type as a double
+		std::optional<double> number() const;
+
+		std::optional<std::string_view> string() const;
+
+		// copies out a packed array
+		std::optional<PackedArray> packed() const;
+
+		// the element type of a packed array
+		inline uint8_t element_type() const
+		{
+			return m_element;
+		}
+
+		// copies the elements of a packed array into out in the machines byte order. out needs room for size() elements
+		bool packed_into(char *out) const;
+
+		// finds a field of a map. v2 maps with an offset table are binary searched
+		std::optional<View> find(std::string_view key) const;
+
+		// follows a path of map keys
+		std::optional<View> find(std::initializer_list<std::string_view> path) const;
+
+		// gets an element of an array
+		std::optional<View> at(size_t index) const;
+
+		// decodes the viewed data into a value
+		std::optional<Value> value() const;
+
+		// the encoded bytes of the value including its header. the root map has no header
+		std::string_view raw() const;
+
+		// iterates the elements of an array or the fields of a map. array elements have an empty key
+		Iterator begin() const;
+		Iterator end() const;
+
+		template<class T>
+		static constexpr Type type_of()
+		{
+			if constexpr (std::is_same_v<T, int8_t>)        return I8;
+			else if constexpr (std::is_same_v<T, uint8_t>)  return U8;
+			else if constexpr (std::is_same_v<T, int16_t>)  return I16;
+			else if constexpr (std::is_same_v<T, uint16_t>) return U16;
+			else if constexpr (std::is_same_v<T, int32_t>)  return I32;
+			else if constexpr (std::is_same_v<T, uint32_t>) return U32;
+			else if constexpr (std::is_same_v<T, int64_t>)  return I64;
+			else if constexpr (std::is_same_v<T, uint64_t>) return U64;
+			else if constexpr (std::is_same_v<T, double>)   return Double;
+			else return AnyT;
+		}
+
+	private:
+		Type m_type = AnyT;
+		uint32_t m_len = 0;
+		// for containers this runs to the end of the buffer unless their encoded size is known up front
+		std::string_view m_body;
+		// the start of the value including its header
+		std::string_view m_start;
+		bool m_reverse = false;
+		bool m_v2 = false;
+		// v2 containers carry their body size and large maps an offset table
+		bool m_tables = false;
+		std::string_view m_table;
+		// v2 integers are variable length so they are decoded up front
+		uint64_t m_int = 0;
+		// the element type of a packed array
+		uint8_t m_element = 0;
+		// how many containers the value is nested in
+		uint16_t m_depth = 0;
+
+		// parses the header of an encoded value
+		static std::optional<View> parse(std::string_view buff, bool reverse, uint16_t depth);
+		static std::optional<View> parse_v2(std::string_view buff, bool tables, uint16_t depth);
+
+		bool read_scalar(Type type, void *out, size_t size) const;
+		bool read_int_v2(void *out, size_t size) const;
+
+		// reads the element type of a packed array and bounds its body. m_len has to be set first
+		bool read_packed_header(std::string_view buff);
+
+		// binary searches the offset table of a v2 map
+		std::optional<View> search(std::string_view key) const;
+
+		// the size of the body in bytes. npos if the data is malformed
+		size_t body_size() const;
+
+		size_t encoded_size() const;
+	};
+
+	class View::Iterator
+	{
+	public:
+		using Entry = std::pair<std::string_view, View>;
+
+		Iterator() = default;
+
+		explicit Iterator(const View &container);
+
+		Iterator& operator++();
+
+		inline const Entry& operator*() const
+		{
+			return m_entry;
+		}
+
+		inline const Entry* operator->() const
+		{
+			return &m_entry;
+		}
+
+		inline bool operator==(const Iterator &other) const
+		{
+			return m_left == other.m_left;
+		}
+
+		inline bool operator!=(const Iterator &other) const
+		{
+			return m_left != other.m_left;
+		}
+
+	private:
+		friend View;
+
+		std::string_view m_rest;
+		uint32_t m_left = 0;
+		bool m_map = false;
+		bool m_reverse = false;
+		bool m_v2 = false;
+		bool m_tables = false;
+		// the depth of the elements
+		uint16_t m_depth = 0;
+		Entry m_entry;
+		// the size of the key header in front of the current value
+		size_t m_prefix = 0;
+		// the encoded size of the current value. 0 until its needed
+		size_t m_size = 0;
+
+		// reads the entry at the front of m_rest. ends the iteration if its malformed
+		void read_entry();
+
+		size_t value_size();
+	};
+}
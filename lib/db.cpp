@@ -1,10 +1,14 @@
 #include "db.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cassert>
+#include <charconv>
 
 #include "transaction.hpp"
+#include "asf_view.hpp"
 #include "types.hpp"
+#include "util.hpp"
 
 namespace ambry
 {
@@ -34,10 +38,19 @@ namespace ambry
     {
         assert(m_ctx.options.enable_cache && "caching must be turned on to use this function");
 
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Get);
+
+        m_ctx.metrics->add(Counter::Gets);
+
         auto iter = m_ctx.index.find(key);
 
         if (iter == m_ctx.index.end())
+        {
+            m_ctx.metrics->add(Counter::GetMisses);
             return {};
+        }
+
+        m_ctx.metrics->add(Counter::CacheHits);
 
         IndexData data = iter->second;
 
@@ -49,18 +62,110 @@ namespace ambry
     std::optional<std::string>
     DB::get(const std::string &key)
     {
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Get);
+
+        m_ctx.metrics->add(Counter::Gets);
+
         auto iter = m_ctx.index.find(key);
 
         if (iter == m_ctx.index.end())
+        {
+            m_ctx.metrics->add(Counter::GetMisses);
             return {};
+        }
 
         IndexData data = iter->second;
         
         return m_im.read_dat(data.offset, data.length);
     }
 
+    std::optional<std::string>
+    DB::get_range(const std::string &key, size_t offset, size_t size)
+    {
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Get);
+
+        m_ctx.metrics->add(Counter::Gets);
+
+        auto iter = m_ctx.index.find(key);
+
+        if (iter == m_ctx.index.end())
+        {
+            m_ctx.metrics->add(Counter::GetMisses);
+            return {};
+        }
+
+        const IndexData &data = iter->second;
+
+        if (offset >= data.length)
+        {
+            return std::string{};
+        }
+
+        size = std::min<size_t>(size, data.length - offset);
+
+        if (m_ctx.options.enable_cache)
+        {
+            m_ctx.metrics->add(Counter::CacheHits);
+            return std::string{(char*)m_ctx.data.data() + data.offset + offset, size};
+        }
+
+        return m_im.read_dat(data.offset + offset, size);
+    }
+
+    Result DB::read_chunked(const std::string &key, size_t chunk_size, const std::function<bool(std::string_view)> &fn)
+    {
+        auto iter = m_ctx.index.find(key);
+
+        if (iter == m_ctx.index.end())
+            return {ResultType::KeyNotFound, "key does not exist in index"};
+
+        if (chunk_size == 0)
+            return {ResultType::InvalidArgument, "chunk size can not be 0"};
+
+        m_ctx.metrics->add(Counter::Gets);
+
+        const IndexData &data = iter->second;
+
+        // cached values are already in memory so the pieces can point straight into the cache
+        if (m_ctx.options.enable_cache)
+        {
+            m_ctx.metrics->add(Counter::CacheHits);
+
+            std::string_view value {(char*)m_ctx.data.data() + data.offset, data.length};
+
+            for (size_t offset = 0; offset < value.size(); offset += chunk_size)
+            {
+                if (!fn(value.substr(offset, chunk_size)))
+                    break;
+            }
+
+            return {};
+        }
+
+        std::string buff;
+
+        buff.resize(std::min<size_t>(chunk_size, data.length));
+
+        for (size_t offset = 0; offset < data.length; offset += chunk_size)
+        {
+            uint32_t size = std::min<size_t>(chunk_size, data.length - offset);
+
+            if (m_im.read_dat_into(buff.data(), data.offset + offset, size) != size)
+                return {ResultType::IoFailure, "could not read value"};
+
+            if (!fn({buff.data(), size}))
+                break;
+        }
+
+        return {};
+    }
+
     Result DB::set(std::string_view key, std::string_view value)
     {
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Set);
+
+        m_ctx.metrics->add(Counter::Sets);
+
         auto [pair, emplaced] = m_ctx.index.emplace(key, IndexData{});
 
         if (!emplaced)
@@ -80,6 +185,10 @@ namespace ambry
 
     Result DB::erase(const std::string &key)
     {
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Erase);
+
+        m_ctx.metrics->add(Counter::Erases);
+
         auto iter = m_ctx.index.find(key);
 
         if (iter == m_ctx.index.end())
@@ -87,17 +196,21 @@ namespace ambry
         
         IndexData data = iter->second;
 
-        m_ctx.index.erase(iter);
-
         m_rw.free(data.offset, data.length);
 
         m_im.erase(*iter);
 
+        m_ctx.index.erase(iter);
+
         return {};
     }
 
     Result DB::update(const std::string &key, std::string_view value)
     {
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Update);
+
+        m_ctx.metrics->add(Counter::Updates);
+
         auto iter = m_ctx.index.find(key);
 
         if (iter == m_ctx.index.end())
@@ -113,6 +226,258 @@ namespace ambry
         return {};
     }
 
+    std::string_view DB::read_value(const IndexData &data, std::string &scratch)
+    {
+        if (m_ctx.options.enable_cache)
+        {
+            return {(char*)m_ctx.data.data() + data.offset, data.length};
+        }
+
+        scratch = m_im.read_dat(data.offset, data.length);
+
+        return scratch;
+    }
+
+    Result DB::get_many(const std::vector<std::string_view> &keys, std::vector<std::optional<std::string_view>> &out, std::string &scratch)
+    {
+        out.assign(keys.size(), std::nullopt);
+
+        m_ctx.metrics->add(Counter::Gets, keys.size());
+
+        std::vector<const IndexData*> found(keys.size());
+        std::string lookup;
+
+        size_t total = 0;
+
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            lookup.assign(keys[i]);
+
+            auto iter = m_ctx.index.find(lookup);
+
+            if (iter == m_ctx.index.end())
+            {
+                m_ctx.metrics->add(Counter::GetMisses);
+                continue;
+            }
+
+            found[i] = &iter->second;
+            total += iter->second.length;
+        }
+
+        if (m_ctx.options.enable_cache)
+        {
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (found[i])
+                {
+                    m_ctx.metrics->add(Counter::CacheHits);
+                    out[i] = std::string_view{(char*)m_ctx.data.data() + found[i]->offset, found[i]->length};
+                }
+            }
+
+            return {};
+        }
+
+        // scratch is sized once up front so the views handed out below stay valid
+        scratch.resize(total);
+
+        std::vector<IoManager::DatRead> reads;
+        size_t pos = 0;
+
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (found[i])
+            {
+                reads.push_back({found[i]->offset, found[i]->length, scratch.data() + pos});
+                out[i] = std::string_view{scratch.data() + pos, found[i]->length};
+                pos += found[i]->length;
+            }
+        }
+
+        if (!m_im.read_dat_many(reads))
+        {
+            out.assign(keys.size(), std::nullopt);
+            return {ResultType::IoFailure, "could not read value"};
+        }
+
+        return {};
+    }
+
+    Result DB::increment(std::string_view key, int64_t delta, int64_t &out)
+    {
+        auto iter = m_ctx.index.find(std::string{key});
+
+        if (iter == m_ctx.index.end())
+        {
+            out = delta;
+            return set(key, std::to_string(delta));
+        }
+
+        std::string scratch;
+
+        std::string_view value = read_value(iter->second, scratch);
+
+        int64_t n;
+
+        auto [end, ec] = std::from_chars(value.data(), value.data()+value.size(), n);
+
+        if (ec != std::errc() || end != value.data()+value.size())
+        {
+            return {ResultType::NotANumber, "value is not an integer"};
+        }
+
+        if (__builtin_add_overflow(n, delta, &out))
+        {
+            return {ResultType::NotANumber, "increment would overflow"};
+        }
+
+        return update(iter->first, std::to_string(out));
+    }
+
+    Result DB::append(const std::string &key, std::string_view value)
+    {
+        auto iter = m_ctx.index.find(key);
+
+        if (iter == m_ctx.index.end())
+            return {ResultType::KeyNotFound, "key does not exist in index"};
+
+        std::string scratch;
+
+        std::string buff { read_value(iter->second, scratch) };
+
+        buff += value;
+
+        return update(key, buff);
+    }
+
+    Result DB::compare_and_set(const std::string &key, std::string_view expected, std::string_view value)
+    {
+        auto iter = m_ctx.index.find(key);
+
+        if (iter == m_ctx.index.end())
+            return {ResultType::KeyNotFound, "key does not exist in index"};
+
+        std::string scratch;
+
+        if (read_value(iter->second, scratch) != expected)
+            return {ResultType::ValueMismatch, "value does not match the expected value"};
+
+        return update(key, value);
+    }
+
+    Result DB::patch(const std::string &key, const std::vector<Patch> &patches)
+    {
+        ScopedTimer timer(m_ctx.metrics.get(), Op::Update);
+
+        m_ctx.metrics->add(Counter::Updates);
+
+        auto iter = m_ctx.index.find(key);
+
+        if (iter == m_ctx.index.end())
+            return {ResultType::KeyNotFound, "key does not exist in index"};
+
+        IndexData &data = iter->second;
+
+        std::string scratch;
+
+        std::string_view current = read_value(data, scratch);
+
+        // a single scalar change can be encoded straight over the old bytes without decoding anything
+        if (patches.size() == 1)
+        {
+            auto in_place = patch_in_place(current, patches[0]);
+
+            if (in_place)
+            {
+                auto &[offset, bytes] = *in_place;
+
+                m_rw.write_at(data.offset + offset, bytes);
+
+                return {};
+            }
+        }
+
+        // decoded through a view since the value might not be serialized data at all
+        auto view = View::from(current);
+        auto value = view && view->type() == MapT ? view->value() : std::nullopt;
+
+        if (!value)
+            return {ResultType::ParseError, "value is not a serialized map"};
+
+        Map &map = std::get<MapT>(*value);
+
+        for (const auto &patch : patches)
+        {
+            Result result = apply_patch(map, patch);
+
+            if (!result.ok())
+                return result;
+        }
+
+        std::string next = serialize_like(current, map);
+
+        if (next.size() != current.size())
+        {
+            data.offset = m_rw.update(data.offset, data.length, next);
+            data.length = next.size();
+
+            m_im.update(*iter);
+
+            return {};
+        }
+
+        auto [first, _] = std::mismatch(next.begin(), next.end(), current.begin());
+
+        if (first == next.end())
+            return {};
+
+        size_t start = first - next.begin();
+        size_t end = next.size();
+
+        while (next[end-1] == current[end-1])
+            end--;
+
+        m_rw.write_at(data.offset + start, std::string_view(next).substr(start, end - start));
+
+        return {};
+    }
+
+    uint64_t DB::scan(uint64_t cursor, size_t count, std::string_view pattern, const std::function<void(std::string_view)> &fn) const
+    {
+        const auto &index = m_ctx.index;
+
+        // a cursor is the bucket count it was made with and the next bucket to look at
+        uint64_t buckets = index.bucket_count();
+        uint64_t bucket = cursor & 0xffffffff;
+
+        // a resize moves keys to other buckets so the scan has to start over
+        if (cursor >> 32 != (buckets & 0xffffffff))
+            bucket = 0;
+
+        size_t seen = 0;
+        size_t visited = 0;
+
+        count = std::max<size_t>(count, 1);
+
+        // empty buckets count too so a sparse index still gives bounded pages
+        for (; bucket < buckets && seen < count && visited < count * 10; bucket++, visited++)
+        {
+            for (auto iter = index.begin(bucket); iter != index.end(bucket); iter++)
+            {
+                seen++;
+
+                if (pattern.empty() || glob_match(pattern, iter->first))
+                    fn(iter->first);
+            }
+        }
+
+        if (bucket >= buckets)
+            return 0;
+
+        return (buckets & 0xffffffff) << 32 | bucket;
+    }
+
     Transaction DB::begin_transaction()
     {
         return Transaction(*this);
@@ -176,4 +541,62 @@ namespace ambry
     {
         return m_ctx.options.enable_cache;
     }
-}
\ No newline at end of file
+
+    Stats DB::stats() const
+    {
+        return m_ctx.metrics->snapshot();
+    }
+
+    void DB::reset_stats()
+    {
+        m_ctx.metrics->reset();
+    }
+
+    // how many keys usage looks at to estimate how much memory keys take
+    constexpr size_t USAGE_SAMPLE = 1024;
+
+    Usage DB::usage() const
+    {
+        using Node = decltype(m_ctx.index)::value_type;
+
+        Usage out;
+
+        out.keys = m_ctx.index.size();
+
+        // every node holds a pointer to the next node and its cached hash next to the pair
+        out.index_bytes = m_ctx.index.bucket_count() * sizeof(void*) + out.keys * (sizeof(Node) + sizeof(void*) + sizeof(size_t));
+
+        size_t sampled = 0;
+        size_t key_bytes = 0;
+
+        for (auto iter = m_ctx.index.begin(); iter != m_ctx.index.end() && sampled < USAGE_SAMPLE; iter++, sampled++)
+        {
+            const std::string &key = iter->first;
+
+            // short keys are stored inside the string itself
+            bool inline_key = key.data() >= (const char*)&key && key.data() < (const char*)&key + sizeof(key);
+
+            key_bytes += inline_key ? 0 : key.capacity() + 1;
+        }
+
+        if (sampled)
+        {
+            out.index_bytes += key_bytes * out.keys / sampled;
+        }
+
+        out.cache_bytes = m_ctx.data.capacity();
+
+        out.dat_bytes = m_im.file_size(IoManager::DAT);
+        out.idx_bytes = m_im.file_size(IoManager::IDX);
+        out.free_bytes = m_im.file_size(IoManager::FREE);
+
+        out.free_entries = m_ctx.free_list.size();
+
+        for (const auto &[size, _] : m_ctx.free_list)
+        {
+            out.free_space += size;
+        }
+
+        return out;
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 
 #include "cache.hpp"
@@ -7,6 +8,7 @@
 #include "types.hpp"
 #include "transaction.hpp"
 #include "rw.hpp"
+#include "patch.hpp"
 #include <iostream>
 
 namespace ambry
@@ -23,6 +25,7 @@ namespace ambry
         {
             m_ctx.name = name;
             m_ctx.options = options;
+            m_ctx.metrics->enabled = options.enable_stats;
         }
 
         DB(DB &&db) :
@@ -55,6 +58,47 @@ namespace ambry
 
         Result erase(const std::string &key);
 
+        // reads at most size bytes of a value starting at offset
+        std::optional<std::string>
+        get_range(const std::string &key, size_t offset, size_t size);
+
+        /*
+            calls fn with consecutive pieces of a value of at most chunk_size bytes
+            so a large value never has to be in memory all at once. stops early if fn returns false
+        */
+        Result read_chunked(const std::string &key, size_t chunk_size, const std::function<bool(std::string_view)> &fn);
+
+        /*
+            looks up several keys at once. out gets a view of each value in the order of keys, or nothing for a missing key.
+            uncached values are read into scratch with one preadv per run of values that sit next to each other on disk,
+            so the views are only valid until scratch changes
+        */
+        Result get_many(const std::vector<std::string_view> &keys, std::vector<std::optional<std::string_view>> &out, std::string &scratch);
+
+        // adds delta to a value stored as a decimal integer and writes the new value to out. a missing key starts at 0
+        Result increment(std::string_view key, int64_t delta, int64_t &out);
+
+        // appends to the end of an existing value
+        Result append(const std::string &key, std::string_view value);
+
+        // only updates the value if it currently equals expected
+        Result compare_and_set(const std::string &key, std::string_view expected, std::string_view value);
+
+        /*
+            applies patches to a value holding a serialized map. when the new value is the same size
+            only the bytes that changed are written, otherwise the whole value is rewritten.
+            either every patch is applied or none are
+        */
+        Result patch(const std::string &key, const std::vector<Patch> &patches);
+
+        /*
+            calls fn with the keys of a page of the index. start with a cursor of 0 and pass the returned
+            cursor back in until it returns 0. count is roughly how many keys a page looks at, a pattern
+            filters them with glob_match. keys that exist for the whole scan are returned at least once,
+            if the index grows in between some may be returned twice
+        */
+        uint64_t scan(uint64_t cursor, size_t count, std::string_view pattern, const std::function<void(std::string_view)> &fn) const;
+
         Transaction begin_transaction();
 
         Iterator begin();
@@ -75,6 +119,14 @@ namespace ambry
         
         bool is_cached() const;
 
+        // a snapshot of the counters and latency histograms since the db was opened or last reset
+        Stats stats() const;
+
+        void reset_stats();
+
+        // the memory and disk the database is using. the size of the keys is estimated from a sample so it stays cheap on large indexes
+        Usage usage() const;
+
     private:
         friend Iterator;
 
@@ -87,6 +139,9 @@ namespace ambry
 
         Result set_bytes(std::string_view key, const uint8_t *bytes, uint32_t size);
 
+        // returns a view of the stored value. scratch holds the data when it has to be read from disk
+        std::string_view read_value(const IndexData &data, std::string &scratch);
+
     public:
         class Iterator
         {
@@ -128,7 +183,7 @@ namespace ambry
                 }
                 else
                 {
-                    auto value = m_cached_strings.emplace_back(m_db.get(m_iter->first).value());
+                    auto &value = m_cached_strings.emplace_back(m_db.get(m_iter->first).value());
                     return {m_iter->first, value};
                 }
             }
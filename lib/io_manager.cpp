@@ -6,7 +6,11 @@
 #include <fcntl.h>
 
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
@@ -18,6 +22,13 @@
 	the first byte of all database files (except .dat) should be either 0 or 1 to determine endianness of the data
 */
 
+// the smallest number of index records a parsing thread will be given
+constexpr size_t MIN_PARALLEL_RECORDS = 1 << 16;
+
+// extra parsing threads running for every index being loaded so concurrent opens and preloads
+// never start more of them than there are cores
+static std::atomic<size_t> parse_threads = 0;
+
 namespace ambry
 {
 	IoManager::~IoManager()
@@ -27,10 +38,17 @@ namespace ambry
 
 	void IoManager::cleanup()
 	{
-		for (auto f : m_files)
+		for (auto &f : m_files)
 		{
+			if (f == -1)
+			{
+				continue;
+			}
+
 			flock(f, LOCK_UN);
 			close(f);
+
+			f = -1;
 		}
 	}
 
@@ -150,6 +168,70 @@ namespace ambry
 		return lseek(fd, 0, SEEK_CUR);
 	}
 
+	template<class T>
+	T read_n(const char *bytes, uint8_t endian)
+	{
+		T n{};
+
+		std::memcpy(&n, bytes, sizeof(T));
+
+		if (machine_endian() != endian)
+		{
+			auto b = (char*)&n;
+			std::reverse(b, b+sizeof(T));
+		}
+
+		return n;
+	}
+
+	// each chunk is hashed by the thread that parses it so merging only relinks the nodes
+	using IndexChunk = std::unordered_map<std::string, IndexData>;
+
+	// parses the valid records starting at the given buffer offsets
+	void parse_records(std::string_view buff, const size_t *records, size_t n, uint8_t endian, IndexChunk &out)
+	{
+		out.reserve(n);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			const char *rec = buff.data() + records[i];
+
+			auto key_len = read_n<uint16_t>(rec, endian);
+
+			IndexData data;
+
+			// the buffer starts after the endian byte of the file
+			data.idx_offset = records[i] + 1 + 2;
+
+			const char *key = rec + 3;
+
+			data.offset = read_n<uint64_t>(key + key_len, endian);
+			data.length = read_n<uint32_t>(key + key_len + 8, endian);
+
+			out.emplace(std::string{key, key_len}, data);
+		}
+	}
+
+	// takes up to want parsing threads out of what is left of the process wide budget
+	size_t claim_parse_threads(size_t want)
+	{
+		size_t limit = std::max(1u, std::thread::hardware_concurrency()) - 1;
+		size_t running = parse_threads.load(std::memory_order_relaxed);
+		size_t n;
+
+		do
+		{
+			n = std::min(want, limit > running ? limit - running : 0);
+
+			if (n == 0)
+			{
+				return 0;
+			}
+		} while (!parse_threads.compare_exchange_weak(running, running + n, std::memory_order_relaxed));
+
+		return n;
+	}
+
 	/*
 		the index format is as follows:
 		2 bytes for the key length
@@ -157,6 +239,9 @@ namespace ambry
 		the key
 		8 bytes for the offset in the dat file
 		4 bytes for the length of the data
+
+		the whole file is read in one go and the record boundaries are found serially. for large indexes
+		the keys are then hashed into per thread tables which are merged into the index in file order
 	*/
 	Result IoManager::load_index()
 	{
@@ -171,35 +256,101 @@ namespace ambry
 
 		uint8_t endian = handle_endian(fd);
 
-		while (curr_offset(fd) < fsize)
+		if (fsize <= 1)
 		{
-			IndexData data;
+			return {};
+		}
 
-			auto key_len = read_n<uint16_t>(fd, endian);
+		std::string buff;
+
+		buff.resize(fsize-1);
+
+		if (pread(fd, buff.data(), buff.size(), 1) != (ssize_t)buff.size())
+		{
+			return {ResultType::IoFailure, "could not read index file"};
+		}
 
-			data.idx_offset = curr_offset(fd);
+		// the records are variable length so their boundaries have to be found serially
+		std::vector<size_t> records;
 
-			uint8_t is_valid = read_byte(fd);
+		size_t offset = 0;
 
-			if (!is_valid)
+		while (offset < buff.size())
+		{
+			if (offset + 3 > buff.size())
 			{
-				uint64_t offset = key_len + sizeof(uint64_t) + sizeof(uint32_t);
-				lseek(fd, offset, SEEK_CUR);
-				continue;
+				return {ResultType::MalformedIdx, "index file is truncated"};
 			}
 
-			std::string key;
+			auto key_len = read_n<uint16_t>(buff.data()+offset, endian);
 
-			key.resize(key_len);
+			size_t record_size = 3 + key_len + sizeof(uint64_t) + sizeof(uint32_t);
 
-			read(fd, key.data(), key_len);
+			if (offset + record_size > buff.size())
+			{
+				return {ResultType::MalformedIdx, "index file is truncated"};
+			}
 
-			data.offset = read_n<uint64_t>(fd, endian);
-			data.length = read_n<uint32_t>(fd, endian);
+			if (buff[offset+2])
+			{
+				records.push_back(offset);
+			}
 
-			m_ctx.index.emplace(std::move(key), data);
+			offset += record_size;
 		}
 
+		// the calling thread parses the first chunk itself
+		size_t extra = claim_parse_threads(records.size() / MIN_PARALLEL_RECORDS);
+
+		std::vector<IndexChunk> chunks(extra + 1);
+
+		if (extra == 0)
+		{
+			parse_records(buff, records.data(), records.size(), endian, chunks[0]);
+		}
+		else
+		{
+			std::vector<std::thread> workers;
+
+			size_t threads = extra + 1;
+			size_t per_chunk = records.size() / threads;
+
+			for (size_t i = 1; i < threads; i++)
+			{
+				size_t start = i * per_chunk;
+				size_t n = i+1 == threads ? records.size()-start : per_chunk;
+
+				workers.emplace_back(parse_records, std::string_view{buff}, 
+					records.data()+start, n, endian, std::ref(chunks[i]));
+			}
+
+			parse_records(buff, records.data(), per_chunk, endian, chunks[0]);
+
+			for (auto &worker : workers)
+			{
+				worker.join();
+			}
+
+			parse_threads.fetch_sub(extra, std::memory_order_relaxed);
+		}
+
+		if (m_ctx.index.empty() && chunks.size() == 1)
+		{
+			m_ctx.index = std::move(chunks[0]);
+		}
+		else
+		{
+			m_ctx.index.reserve(m_ctx.index.size() + records.size());
+
+			// earlier records win like they did when inserting one at a time
+			for (auto &chunk : chunks)
+			{
+				m_ctx.index.merge(chunk);
+			}
+		}
+
+		lseek(fd, 0, SEEK_END);
+
 		return {};
 	}
 
@@ -280,6 +431,9 @@ namespace ambry
 		};
 
 		writev(fd, iov, n);
+
+		m_ctx.metrics->add(Counter::Syscalls, 2);
+		m_ctx.metrics->add(Counter::BytesWritten, 2 + 1 + key.size() + 8 + 4);
 	}
 
 	void IoManager::erase(Entry &entry)
@@ -289,6 +443,9 @@ namespace ambry
 		lseek(fd, entry.second.idx_offset, SEEK_SET);
 
 		write_byte(fd, 0);
+
+		m_ctx.metrics->add(Counter::Syscalls, 2);
+		m_ctx.metrics->add(Counter::BytesWritten, 1);
 	}
 
 	void IoManager::update(Entry &entry)
@@ -304,6 +461,9 @@ namespace ambry
 		};
 
 		pwritev(fd, iov, 2, data.idx_offset + entry.first.size() + 1);
+
+		m_ctx.metrics->add(Counter::Syscalls);
+		m_ctx.metrics->add(Counter::BytesWritten, 12);
 	}
 
 	void IoManager::erase_freelist(uint64_t offset)
@@ -313,6 +473,9 @@ namespace ambry
 		static const char data[12]{};
 
 		pwrite(fd, data, 12, offset);
+
+		m_ctx.metrics->add(Counter::Syscalls);
+		m_ctx.metrics->add(Counter::BytesWritten, 12);
 	}
 
 	size_t IoManager::update_freelist(size_t offset, uint32_t size)
@@ -329,6 +492,9 @@ namespace ambry
 
 		writev(fd, iov, 2);
 
+		m_ctx.metrics->add(Counter::Syscalls, 2);
+		m_ctx.metrics->add(Counter::BytesWritten, 12);
+
 		return n;
 	}
 
@@ -339,24 +505,84 @@ namespace ambry
 		if (offset == std::string::npos)
 		{
 			offset = lseek(fd, 0, SEEK_END);
+			m_ctx.metrics->add(Counter::Syscalls);
 		}
 
 		pwrite(fd, bytes, size, offset);
 
+		m_ctx.metrics->add(Counter::Syscalls);
+		m_ctx.metrics->add(Counter::BytesWritten, size);
+
 		return offset;
 	}
 
 	std::string IoManager::read_dat(size_t offset, uint32_t size)
 	{
-		int fd = m_files[DAT];
-
 		std::string buff;
 
 		buff.resize(size);
 
-		pread(fd, buff.data(), size, offset);
+		read_dat_into(buff.data(), offset, size);
 
 		return buff;
 	}
 
+	size_t IoManager::read_dat_into(char *out, size_t offset, uint32_t size)
+	{
+		ssize_t read = pread(m_files[DAT], out, size, offset);
+
+		m_ctx.metrics->add(Counter::Syscalls);
+		m_ctx.metrics->add(Counter::BytesRead, size);
+
+		return read < 0 ? 0 : read;
+	}
+
+	size_t IoManager::file_size(FType type) const
+	{
+		struct stat st;
+
+		if (m_files[type] == -1 || fstat(m_files[type], &st) == -1)
+		{
+			return 0;
+		}
+
+		return st.st_size;
+	}
+
+	bool IoManager::read_dat_many(std::vector<DatRead> &reads)
+	{
+		std::sort(reads.begin(), reads.end(), [](const DatRead &a, const DatRead &b)
+		{
+			return a.offset < b.offset;
+		});
+
+		std::vector<iovec> iov;
+
+		for (size_t i = 0; i < reads.size();)
+		{
+			size_t start = reads[i].offset;
+			size_t end = start;
+
+			iov.clear();
+
+			// a run continues while the next value starts where the last one ended
+			for (; i < reads.size() && reads[i].offset == end && iov.size() < IOV_MAX; i++)
+			{
+				iov.push_back({reads[i].out, reads[i].size});
+				end += reads[i].size;
+			}
+
+			ssize_t read = preadv(m_files[DAT], iov.data(), iov.size(), start);
+
+			m_ctx.metrics->add(Counter::Syscalls);
+			m_ctx.metrics->add(Counter::BytesRead, end - start);
+
+			if (read != (ssize_t)(end - start))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
 };
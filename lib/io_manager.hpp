@@ -28,7 +28,9 @@ namespace ambry
 			m_ctx(context),
 			m_files(std::move(im.m_files)),
 			m_file_ext(std::move(im.m_file_ext))
-		{}
+		{
+			im.m_files.fill(-1);
+		}
 
 		~IoManager();
 
@@ -56,6 +58,25 @@ namespace ambry
 
 		std::string read_dat(size_t offset, uint32_t size);
 
+		// reads into a caller provided buffer of at least size bytes. returns the number of bytes read
+		size_t read_dat_into(char *out, size_t offset, uint32_t size);
+
+		// the size of one of the files on disk or 0 if it is not open
+		size_t file_size(FType type) const;
+
+		struct DatRead
+		{
+			size_t offset;
+			uint32_t size;
+			char *out;
+		};
+
+		/*
+			performs several reads of the data file. reads are sorted by offset and values that sit next
+			to each other on disk are read with a single preadv. returns false if any read came up short
+		*/
+		bool read_dat_many(std::vector<DatRead> &reads);
+
 		/*
 			the index file format is as follows:
 			2 bytes for the key length
@@ -78,7 +99,7 @@ namespace ambry
 	private:
 		DBContext &m_ctx;
 
-		std::array<int, 3> m_files;
+		std::array<int, 3> m_files { -1, -1, -1 };
 
 		const std::array<std::string_view, 3> m_file_ext 
 		{
@@ -0,0 +1,271 @@
+#include "patch.hpp"
+#include "asf_common.hpp"
+#include "asf_v2.hpp"
+#include "asf_view.hpp"
+#include "util.hpp"
+
+#include <utility>
+
+namespace ambry
+{
+	std::optional<int64_t> integer_of(const Value &value)
+	{
+		return std::visit([](const auto &n) -> std::optional<int64_t>
+		{
+			using T = std::decay_t<decltype(n)>;
+
+			if constexpr (std::is_integral_v<T>)
+			{
+				if constexpr (std::is_same_v<T, uint64_t>)
+				{
+					if (n > uint64_t(INT64_MAX))
+					{
+						return std::nullopt;
+					}
+				}
+
+				return int64_t(n);
+			}
+			else
+			{
+				return std::nullopt;
+			}
+		}, (const ValueBase&)value);
+	}
+
+	std::optional<double> number_of(const Value &value)
+	{
+		return std::visit([](const auto &n) -> std::optional<double>
+		{
+			using T = std::decay_t<decltype(n)>;
+
+			if constexpr (std::is_arithmetic_v<T>)
+				return double(n);
+			else
+				return std::nullopt;
+		}, (const ValueBase&)value);
+	}
+
+	// adds delta to a number keeping its type
+	Result increment_value(Value &target, const Value &delta)
+	{
+		return std::visit([&](auto &n) -> Result
+		{
+			using T = std::decay_t<decltype(n)>;
+
+			if constexpr (std::is_floating_point_v<T>)
+			{
+				auto d = number_of(delta);
+
+				if (!d)
+				{
+					return {ResultType::NotANumber, "increment is not a number"};
+				}
+
+				n += *d;
+
+				return {};
+			}
+			else if constexpr (std::is_integral_v<T>)
+			{
+				auto d = integer_of(delta);
+
+				if (!d)
+				{
+					return {ResultType::NotANumber, "increment is not an integer"};
+				}
+
+				if (__builtin_add_overflow(n, *d, &n))
+				{
+					return {ResultType::NotANumber, "increment would overflow"};
+				}
+
+				return {};
+			}
+			else
+			{
+				return {ResultType::NotANumber, "field is not a number"};
+			}
+		}, (ValueBase&)target);
+	}
+
+	Result append_value(Value &target, const Value &value)
+	{
+		if (target.index() == ArrayT)
+		{
+			std::get<ArrayT>(target).push_back(value);
+			return {};
+		}
+
+		if (target.index() != PackedT)
+		{
+			return {ResultType::InvalidArgument, "field is not an array"};
+		}
+
+		return std::visit([&](auto &vec) -> Result
+		{
+			using T = typename std::decay_t<decltype(vec)>::value_type;
+
+			if constexpr (std::is_integral_v<T>)
+			{
+				auto n = integer_of(value);
+
+				if (!n || !std::in_range<T>(*n))
+				{
+					return {ResultType::NotANumber, "value does not fit in the packed array"};
+				}
+
+				vec.push_back(T(*n));
+			}
+			else
+			{
+				auto n = number_of(value);
+
+				if (!n)
+				{
+					return {ResultType::NotANumber, "packed arrays can only hold numbers"};
+				}
+
+				vec.push_back(T(*n));
+			}
+
+			return {};
+		}, (PackedBase&)std::get<PackedT>(target));
+	}
+
+	Result apply_patch(Map &map, const Patch &patch)
+	{
+		if (patch.path.empty())
+		{
+			return {ResultType::InvalidArgument, "a patch needs a path"};
+		}
+
+		Map *parent = &map;
+
+		for (size_t i = 0; i+1 < patch.path.size(); i++)
+		{
+			auto iter = parent->find(patch.path[i]);
+
+			if (iter == parent->end())
+			{
+				return {ResultType::KeyNotFound, "path does not exist"};
+			}
+
+			if (iter->second.index() != MapT)
+			{
+				return {ResultType::InvalidArgument, "path does not lead through maps"};
+			}
+
+			parent = &std::get<MapT>(iter->second);
+		}
+
+		const std::string &key = patch.path.back();
+
+		if (patch.op == PatchOp::Set)
+		{
+			parent->insert_or_assign(key, patch.value);
+			return {};
+		}
+
+		auto iter = parent->find(key);
+
+		if (iter == parent->end())
+		{
+			return {ResultType::KeyNotFound, "path does not exist"};
+		}
+
+		switch (patch.op)
+		{
+			case PatchOp::Remove:
+			{
+				parent->erase(iter);
+				return {};
+			}
+			case PatchOp::Append: return append_value(iter->second, patch.value);
+			case PatchOp::Increment: return increment_value(iter->second, patch.value);
+			default: return {};
+		}
+	}
+
+	std::optional<std::pair<size_t, std::string>>
+	patch_in_place(std::string_view data, const Patch &patch)
+	{
+		if (patch.op != PatchOp::Set && patch.op != PatchOp::Increment)
+		{
+			return std::nullopt;
+		}
+
+		bool v2 = is_v2(data);
+
+		// the new value is encoded in the machines byte order
+		if (!v2 && data.size() > 1 && data[1] != machine_endian())
+		{
+			return std::nullopt;
+		}
+
+		auto target = View::from(data);
+
+		if (!target || target->type() != MapT || patch.path.empty())
+		{
+			return std::nullopt;
+		}
+
+		for (const auto &key : patch.path)
+		{
+			target = target->find(key);
+
+			if (!target)
+			{
+				return std::nullopt;
+			}
+		}
+
+		if (target->type() == ArrayT || target->type() == MapT || target->type() == PackedT)
+		{
+			return std::nullopt;
+		}
+
+		Value value;
+
+		if (patch.op == PatchOp::Set)
+		{
+			if (patch.value.index() != target->type())
+			{
+				return std::nullopt;
+			}
+
+			value = patch.value;
+		}
+		else
+		{
+			auto opt = target->value();
+
+			if (!opt || !increment_value(*opt, patch.value).ok())
+			{
+				return std::nullopt;
+			}
+
+			value = std::move(*opt);
+		}
+
+		std::string encoded = v2 ? serialize_value_v2(value) : serialize_value(value);
+		std::string_view raw = target->raw();
+
+		if (encoded.size() - HEADER_SIZE != raw.size())
+		{
+			return std::nullopt;
+		}
+
+		return {{ raw.data() - data.data(), encoded.substr(HEADER_SIZE) }};
+	}
+
+	std::string serialize_like(std::string_view original, const Map &map)
+	{
+		if (is_v2(original))
+		{
+			return serialize_v2(map, { .offset_tables = bool(original[1] & V2_TABLES) });
+		}
+
+		return serialize(map);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// changes to single fields of stored asf maps
+
+#include "asf.hpp"
+#include "types.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ambry
+{
+	enum class PatchOp : uint8_t
+	{
+		// sets a field, adding it if its missing
+		Set,
+		Remove,
+		// pushes the value onto an array or packed array
+		Append,
+		// adds the value to a number
+		Increment,
+	};
+
+	struct Patch
+	{
+		PatchOp op;
+		// the keys leading from the root map to the field
+		std::vector<std::string> path;
+		Value value;
+	};
+
+	Result apply_patch(Map &map, const Patch &patch);
+
+	/*
+		tries to express a patch as an overwrite of the bytes of a single value in serialized data.
+		this works when a scalar or string is replaced by one that encodes to the same size.
+		returns the offset of the value in data and its new bytes
+	*/
+	std::optional<std::pair<size_t, std::string>>
+	patch_in_place(std::string_view data, const Patch &patch);
+
+	// serializes a map with the same format and options as some existing serialized data
+	std::string serialize_like(std::string_view original, const Map &map);
+}
@@ -11,11 +11,11 @@ namespace ambry
 
 		size_t offset = std::string::npos;
 
-		auto free_opt = find_free(slice.size());
+		auto free_iter = find_free(size);
 
-		if (free_opt)
+		if (free_iter != m_context.free_list.end())
 		{
-			offset = manage_free(free_opt.value(), size);
+			offset = manage_free(free_iter, size);
 		}
 
 		if (m_context.options.enable_cache)
@@ -33,28 +33,46 @@ namespace ambry
 		size_t size   = slice.size();
 		size_t offset = std::string::npos;
 
-		if (old_size < size)
+		// a value that still fits is rewritten in place and whatever is left of the old slot is freed
+		if (size <= old_size)
 		{
 			offset = old_offset;
+
+			if (size < old_size)
+			{
+				free(old_offset+size, old_size-size);
+			}
 		}
 		else
 		{
-			auto free_opt = find_free(size);
+			auto free_iter = find_free(size);
 
-			if (free_opt)
+			if (free_iter != m_context.free_list.end())
 			{
-				offset = manage_free(free_opt.value(), size);
+				offset = manage_free(free_iter, size);
 			}
+
+			free(old_offset, old_size);
+		}
+
+		if (m_context.options.enable_cache)
+		{
+			m_cache.write(slice.data(), offset, size);
 		}
 		
 		offset = m_io_manager.write_dat(slice.data(), offset, size);
-		
+
+		return offset;
+	}
+
+	void RW::write_at(size_t offset, std::string_view slice)
+	{
 		if (m_context.options.enable_cache)
 		{
-			m_cache.write_at(offset, slice.data(), size);
+			m_cache.write_at(offset, slice.data(), slice.size());
 		}
 
-		return offset;
+		m_io_manager.write_dat(slice.data(), offset, slice.size());
 	}
 
 	void RW::free(size_t offset, size_t size)
@@ -81,11 +99,13 @@ namespace ambry
 		m_context.free_list.emplace(size, FreeEntry{offset, off});
 	}
 
-	size_t RW::manage_free(std::pair<uint32_t, FreeEntry> entry, size_t data_size)
+	size_t RW::manage_free(FreeList::iterator iter, size_t data_size)
 	{
-		auto [size, free] = entry;
+		auto [size, free] = *iter;
+
+		m_context.metrics->add(Counter::FreeReuse);
 
-		m_context.free_list.erase(size);
+		m_context.free_list.erase(iter);
 		m_io_manager.erase_freelist(free.free_list_offset);
 
 		size_t diff = size-data_size;
@@ -96,23 +116,15 @@ namespace ambry
 
 			uint32_t off = m_io_manager.update_freelist(new_offset, diff);
 
-			auto iter = m_context.free_list.emplace(diff, FreeEntry{new_offset, off});
+			m_context.free_list.emplace(diff, FreeEntry{new_offset, off});
 		}
 
 		return free.offset;
 	}
 
-	std::optional<std::pair<uint32_t, FreeEntry>> 
-	RW::find_free(size_t size)
+	RW::FreeList::iterator RW::find_free(size_t size)
 	{
-		for (auto entry : m_context.free_list)
-		{
-			if (entry.first > size)
-			{
-				return entry;
-			}
-		}
-
-		return std::nullopt;
+		// the free list is ordered by size so this is the smallest slot the data fits in
+		return m_context.free_list.lower_bound(size);
 	}
-}
\ No newline at end of file
+}
@@ -35,19 +35,23 @@ namespace ambry
 		size_t write(std::string_view slice);
 
 		size_t update(size_t old_offset, uint32_t old_size, std::string_view slice);
+
+		// overwrites bytes of a value that is already stored without moving it
+		void write_at(size_t offset, std::string_view slice);
 		
 		void free(size_t offset, size_t size);
 
 	private:
+		using FreeList = std::multimap<uint32_t, FreeEntry>;
+
 		DBContext &m_context;
 		IoManager &m_io_manager;
 		Cache m_cache;
 
-		// TODO make sure it also erases the freelist in the .free file
-		size_t manage_free(std::pair<uint32_t, FreeEntry> entry, size_t data_size);
+		// takes the data out of a free slot and puts whatever is left of it back in the free list
+		size_t manage_free(FreeList::iterator iter, size_t data_size);
 
-		std::optional<std::pair<uint32_t, FreeEntry>> 
-		find_free(size_t size);
+		FreeList::iterator find_free(size_t size);
 		
 	};
 }
@@ -0,0 +1,234 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace ambry
+{
+	constexpr uint64_t SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS;
+
+	size_t Histogram::bucket_of(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+		{
+			return value;
+		}
+
+		size_t msb = 63 - __builtin_clzll(value);
+
+		if (msb > HISTOGRAM_MAX_BIT)
+		{
+			return HISTOGRAM_BUCKETS-1;
+		}
+
+		size_t shift = msb - HISTOGRAM_SUB_BITS;
+
+		return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) | ((value >> shift) & (SUB_BUCKETS-1));
+	}
+
+	uint64_t Histogram::bucket_upper(size_t bucket)
+	{
+		if (bucket < SUB_BUCKETS)
+		{
+			return bucket;
+		}
+
+		size_t msb = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+		size_t shift = msb - HISTOGRAM_SUB_BITS;
+
+		uint64_t lower = (SUB_BUCKETS | (bucket & (SUB_BUCKETS-1))) << shift;
+
+		return lower + (uint64_t(1) << shift) - 1;
+	}
+
+	HistogramSnapshot Histogram::snapshot() const
+	{
+		HistogramSnapshot out;
+
+		for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			out.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+			out.count += out.buckets[i];
+		}
+
+		out.sum = m_sum.load(std::memory_order_relaxed);
+		out.max = m_max.load(std::memory_order_relaxed);
+
+		return out;
+	}
+
+	void Histogram::reset()
+	{
+		for (auto &bucket : m_buckets)
+		{
+			bucket.store(0, std::memory_order_relaxed);
+		}
+
+		m_sum.store(0, std::memory_order_relaxed);
+		m_max.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t HistogramSnapshot::percentile(double p) const
+	{
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		uint64_t rank = p / 100 * count;
+
+		if (rank >= count)
+		{
+			rank = count-1;
+		}
+
+		uint64_t seen = 0;
+
+		for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			seen += buckets[i];
+
+			if (seen > rank)
+			{
+				// the bucket bound can overshoot the largest value actually recorded
+				return std::min(Histogram::bucket_upper(i), max);
+			}
+		}
+
+		return max;
+	}
+
+	double HistogramSnapshot::mean() const
+	{
+		return count ? double(sum) / count : 0;
+	}
+
+	void HistogramSnapshot::merge(const HistogramSnapshot &other)
+	{
+		for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+		{
+			buckets[i] += other.buckets[i];
+		}
+
+		count += other.count;
+		sum += other.sum;
+		max = std::max(max, other.max);
+	}
+
+	// the order threads first recorded anything in. a hash of the thread id could put two threads on one shard
+	static std::atomic<size_t> next_thread{};
+
+	static thread_local size_t thread_shard = next_thread.fetch_add(1, std::memory_order_relaxed);
+
+	Metrics::~Metrics()
+	{
+		for (auto &shard : m_shards)
+		{
+			delete shard.load(std::memory_order_relaxed);
+		}
+	}
+
+	void Metrics::bind_thread(size_t index)
+	{
+		thread_shard = index;
+	}
+
+	std::shared_ptr<Metrics> Metrics::none()
+	{
+		static auto metrics = []
+		{
+			auto out = std::make_shared<Metrics>();
+			out->enabled = false;
+			return out;
+		}();
+
+		return metrics;
+	}
+
+	Metrics::Shard &Metrics::shard()
+	{
+		auto &slot = m_shards[thread_shard % SHARDS];
+
+		Shard *shard = slot.load(std::memory_order_acquire);
+
+		if (!shard)
+		{
+			auto fresh = std::make_unique<Shard>();
+
+			// another thread may have allocated it in the meantime
+			if (slot.compare_exchange_strong(shard, fresh.get(), std::memory_order_acq_rel))
+			{
+				shard = fresh.release();
+			}
+		}
+
+		return *shard;
+	}
+
+	Stats Metrics::snapshot() const
+	{
+		Stats out;
+
+		uint64_t counters[size_t(Counter::Count)]{};
+
+		for (const auto &slot : m_shards)
+		{
+			const Shard *shard = slot.load(std::memory_order_acquire);
+
+			if (!shard)
+			{
+				continue;
+			}
+
+			for (size_t i = 0; i < size_t(Counter::Count); i++)
+			{
+				counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+			}
+
+			out.get_latency.merge(shard->latency[size_t(Op::Get)].snapshot());
+			out.set_latency.merge(shard->latency[size_t(Op::Set)].snapshot());
+			out.update_latency.merge(shard->latency[size_t(Op::Update)].snapshot());
+			out.erase_latency.merge(shard->latency[size_t(Op::Erase)].snapshot());
+		}
+
+	#define GET(c) counters[size_t(Counter::c)]
+
+		out.gets = GET(Gets);
+		out.get_misses = GET(GetMisses);
+		out.cache_hits = GET(CacheHits);
+		out.sets = GET(Sets);
+		out.updates = GET(Updates);
+		out.erases = GET(Erases);
+		out.bytes_read = GET(BytesRead);
+		out.bytes_written = GET(BytesWritten);
+		out.free_reuse = GET(FreeReuse);
+		out.syscalls = GET(Syscalls);
+
+	#undef GET
+
+		return out;
+	}
+
+	void Metrics::reset()
+	{
+		for (auto &slot : m_shards)
+		{
+			Shard *shard = slot.load(std::memory_order_acquire);
+
+			if (!shard)
+			{
+				continue;
+			}
+
+			for (auto &counter : shard->counters)
+			{
+				counter.store(0, std::memory_order_relaxed);
+			}
+
+			for (auto &histogram : shard->latency)
+			{
+				histogram.reset();
+			}
+		}
+	}
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+// low overhead counters and latency histograms used to observe what a database is doing
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace ambry
+{
+	enum class Counter : uint8_t
+	{
+		Gets,
+		GetMisses,
+		CacheHits,
+		Sets,
+		Updates,
+		Erases,
+		BytesRead,
+		BytesWritten,
+		FreeReuse,
+		Syscalls,
+		Count,
+	};
+
+	// the operations that have a latency histogram
+	enum class Op : uint8_t
+	{
+		Get, Set, Update, Erase, Count,
+	};
+
+	/*
+		the histogram is log linear. values below 8 get their own bucket,
+		every power of two above that is split into 8 buckets so any reported value is within 12.5% of the real one.
+		values are capped at 2^40 which for nanoseconds is a little over 18 minutes
+	*/
+	constexpr size_t HISTOGRAM_SUB_BITS = 3;
+	constexpr size_t HISTOGRAM_MAX_BIT = 39;
+	constexpr size_t HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_BIT - HISTOGRAM_SUB_BITS + 2) << HISTOGRAM_SUB_BITS;
+
+	// a plain copy of a histogram
+	struct HistogramSnapshot
+	{
+		std::array<uint64_t, HISTOGRAM_BUCKETS> buckets{};
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+
+		// returns the upper bound of the bucket that holds the given percentile (0-100)
+		uint64_t percentile(double p) const;
+
+		double mean() const;
+
+		void merge(const HistogramSnapshot &other);
+	};
+
+	class Histogram
+	{
+	public:
+
+		inline void record(uint64_t value)
+		{
+			m_buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(value, std::memory_order_relaxed);
+
+			uint64_t max = m_max.load(std::memory_order_relaxed);
+
+			while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+		}
+
+		HistogramSnapshot snapshot() const;
+
+		void reset();
+
+		static size_t bucket_of(uint64_t value);
+
+		// the largest value that falls in the given bucket
+		static uint64_t bucket_upper(size_t bucket);
+
+	private:
+		std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> m_buckets{};
+		std::atomic<uint64_t> m_sum{};
+		std::atomic<uint64_t> m_max{};
+	};
+
+	struct Stats
+	{
+		uint64_t gets = 0;
+		uint64_t get_misses = 0;
+		uint64_t cache_hits = 0;
+		uint64_t sets = 0;
+		uint64_t updates = 0;
+		uint64_t erases = 0;
+		uint64_t bytes_read = 0;
+		uint64_t bytes_written = 0;
+		uint64_t free_reuse = 0;
+		uint64_t syscalls = 0;
+
+		// latencies are in nanoseconds
+		HistogramSnapshot get_latency;
+		HistogramSnapshot set_latency;
+		HistogramSnapshot update_latency;
+		HistogramSnapshot erase_latency;
+
+		// the ratio of gets that were served from the cache
+		inline double hit_rate() const
+		{
+			return gets ? double(cache_hits) / gets : 0;
+		}
+	};
+
+	// how much memory and disk a database takes up
+	struct Usage
+	{
+		size_t keys = 0;
+		// an estimate of the memory used by the index including its keys
+		size_t index_bytes = 0;
+		size_t cache_bytes = 0;
+
+		// the size of each file on disk
+		size_t dat_bytes = 0;
+		size_t idx_bytes = 0;
+		size_t free_bytes = 0;
+
+		// holes in the data file that are waiting to be reused
+		size_t free_entries = 0;
+		size_t free_space = 0;
+
+		// the share of the data file taken up by holes
+		inline double fragmentation() const
+		{
+			return dat_bytes ? double(free_space) / dat_bytes : 0;
+		}
+	};
+
+	/*
+		counters are split into a few cache line aligned shards that are only allocated once a thread records to them.
+		a thread can be bound to a shard of its own, the others are handed shards in turn. reading sums every shard
+	*/
+	class Metrics
+	{
+		struct alignas(64) Shard
+		{
+			std::array<std::atomic<uint64_t>, size_t(Counter::Count)> counters{};
+			std::array<Histogram, size_t(Op::Count)> latency;
+		};
+
+	public:
+
+		static constexpr size_t SHARDS = 16;
+
+		bool enabled = true;
+
+		Metrics() = default;
+
+		Metrics(const Metrics&) = delete;
+
+		Metrics &operator=(const Metrics&) = delete;
+
+		~Metrics();
+
+		inline void add(Counter counter, uint64_t n = 1)
+		{
+			if (enabled)
+			{
+				shard().counters[size_t(counter)].fetch_add(n, std::memory_order_relaxed);
+			}
+		}
+
+		inline void record(Op op, uint64_t ns)
+		{
+			if (enabled)
+			{
+				shard().latency[size_t(op)].record(ns);
+			}
+		}
+
+		Stats snapshot() const;
+
+		void reset();
+
+		// makes the calling thread record to the given shard from now on
+		static void bind_thread(size_t index);
+
+		// shared by contexts that were moved from. it is disabled so it never records anything
+		static std::shared_ptr<Metrics> none();
+
+	private:
+		std::array<std::atomic<Shard*>, SHARDS> m_shards{};
+
+		Shard &shard();
+	};
+
+	// records the time between its construction and destruction to an operations histogram
+	class ScopedTimer
+	{
+		using Clock = std::chrono::steady_clock;
+
+	public:
+		ScopedTimer(Metrics *metrics, Op op) :
+			m_metrics(metrics && metrics->enabled ? metrics : nullptr),
+			m_op(op)
+		{
+			if (m_metrics)
+			{
+				m_start = Clock::now();
+			}
+		}
+
+		~ScopedTimer()
+		{
+			if (m_metrics)
+			{
+				auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start);
+				m_metrics->record(m_op, ns.count());
+			}
+		}
+
+	private:
+		Metrics *m_metrics;
+		Op m_op;
+		Clock::time_point m_start;
+	};
+}
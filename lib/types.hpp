@@ -7,6 +7,10 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <memory>
+#include <utility>
+
+#include "stats.hpp"
 
 namespace ambry
 {
@@ -21,6 +25,9 @@ namespace ambry
         KeyNotFound,
         ParseError,
         InterpretError,
+        NotANumber,
+        ValueMismatch,
+        InvalidArgument,
     };
 
     template<class T>
@@ -55,6 +62,8 @@ namespace ambry
 	struct Options
 	{
         bool enable_cache = true;
+        // counters and latency histograms. cheap enough to leave on
+        bool enable_stats = true;
 	};
 
     // important shared data
@@ -65,6 +74,7 @@ namespace ambry
         std::multimap<uint32_t, FreeEntry> free_list;
         Options options;
         std::string name;
+        std::shared_ptr<Metrics> metrics = std::make_shared<Metrics>();
         
         DBContext() = default;
 
@@ -73,15 +83,20 @@ namespace ambry
             data(std::move(ctx.data)),
             free_list(std::move(ctx.free_list)),
             options(ctx.options),
-            name(std::move(ctx.name))
+            name(std::move(ctx.name)),
+            // the moved from context stays usable but no longer records anything
+            metrics(std::exchange(ctx.metrics, Metrics::none()))
         {}
 
+        // a copy starts with its own empty metrics
         DBContext(const DBContext &ctx) :
             index(ctx.index),
             data(ctx.data),
             free_list(ctx.free_list),
             options(ctx.options),
             name(ctx.name)
-        {}
+        {
+            metrics->enabled = options.enable_stats;
+        }
     };
 }
\ No newline at end of file
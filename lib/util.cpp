@@ -14,4 +14,107 @@ namespace ambry
 
 		#undef TRY
 	}
+
+	// matches one character against the pattern element at p and sets next to the element after it
+	bool glob_match_one(std::string_view pattern, size_t p, char c, size_t &next)
+	{
+		char first = pattern[p];
+
+		if (first == '?')
+		{
+			next = p+1;
+			return true;
+		}
+
+		if (first == '\\' && p+1 < pattern.size())
+		{
+			next = p+2;
+			return pattern[p+1] == c;
+		}
+
+		size_t close = first == '[' ? pattern.find(']', p+2) : std::string_view::npos;
+
+		// a [ with no closing ] is just a character
+		if (close == std::string_view::npos)
+		{
+			next = p+1;
+			return first == c;
+		}
+
+		next = close+1;
+
+		size_t i = p+1;
+
+		bool negate = pattern[i] == '!' || pattern[i] == '^';
+
+		if (negate)
+		{
+			i++;
+		}
+
+		bool found = false;
+
+		for (; i < close; i++)
+		{
+			if (i+2 < close && pattern[i+1] == '-')
+			{
+				found |= c >= pattern[i] && c <= pattern[i+2];
+				i += 2;
+			}
+			else
+			{
+				found |= c == pattern[i];
+			}
+		}
+
+		return found != negate;
+	}
+
+	bool glob_match(std::string_view pattern, std::string_view str)
+	{
+		size_t p = 0;
+		size_t s = 0;
+
+		// where the last * was and how much of the string it has taken so far
+		size_t star = std::string_view::npos;
+		size_t star_s = 0;
+
+		while (s < str.size())
+		{
+			if (p < pattern.size())
+			{
+				if (pattern[p] == '*')
+				{
+					star = p++;
+					star_s = s;
+					continue;
+				}
+
+				size_t next;
+
+				if (glob_match_one(pattern, p, str[s], next))
+				{
+					p = next;
+					s++;
+					continue;
+				}
+			}
+
+			// backtrack by letting the last * take one more character
+			if (star == std::string_view::npos)
+			{
+				return false;
+			}
+
+			p = star+1;
+			s = ++star_s;
+		}
+
+		while (p < pattern.size() && pattern[p] == '*')
+		{
+			p++;
+		}
+
+		return p == pattern.size();
+	}
 }
\ No newline at end of file
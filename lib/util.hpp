@@ -12,6 +12,12 @@ namespace ambry
 
 	Result destroy(const std::string &name);
 
+	/*
+		matches a string against a glob pattern. * matches any run of characters, ? any one character,
+		[abc] or [a-z] one of a set ([!abc] or [^abc] negates it) and \ makes the next character literal
+	*/
+	bool glob_match(std::string_view pattern, std::string_view str);
+
 	// returns 1 for little indian 0 for big
 	static inline 
 	uint8_t machine_endian()
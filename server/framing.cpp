@@ -0,0 +1,87 @@
+#include "framing.hpp"
+
+#include <cstring>
+
+// a buffer that grew past this for a large frame is given back once it is empty
+static constexpr size_t KEEP_SIZE = 1 << 20;
+
+char *FrameReader::prepare(size_t size)
+{
+	if (m_buff.size() - m_end < size)
+	{
+		m_buff.resize(m_end + size);
+	}
+
+	return m_buff.data() + m_end;
+}
+
+void FrameReader::commit(size_t size)
+{
+	m_end += size;
+}
+
+FrameReader::Status FrameReader::next(std::string_view &frame)
+{
+	while (true)
+	{
+		switch (m_state)
+		{
+			case State::Header:
+			{
+				if (buffered() < sizeof(m_length))
+				{
+					return Status::NeedMore;
+				}
+
+				memcpy(&m_length, m_buff.data() + m_start, sizeof(m_length));
+
+				if (m_length > m_max_frame)
+				{
+					return Status::TooLarge;
+				}
+
+				m_start += sizeof(m_length);
+				m_state = State::Body;
+
+				break;
+			}
+			case State::Body:
+			{
+				if (buffered() < m_length)
+				{
+					return Status::NeedMore;
+				}
+
+				frame = { m_buff.data() + m_start, m_length };
+
+				m_start += m_length;
+				m_state = State::Header;
+
+				return Status::Frame;
+			}
+		}
+	}
+}
+
+void FrameReader::compact()
+{
+	if (m_start == m_end)
+	{
+		m_start = m_end = 0;
+
+		if (m_buff.size() > KEEP_SIZE)
+		{
+			m_buff = {};
+		}
+
+		return;
+	}
+
+	if (m_start > 0)
+	{
+		memmove(m_buff.data(), m_buff.data() + m_start, buffered());
+
+		m_end -= m_start;
+		m_start = 0;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+	splits the bytes read from a connection into frames of [u32 length][payload], with the length in the
+	machines byte order. bytes are added as they arrive and a frame is only handed out once all of it
+	is there, so a frame that arrives in pieces is picked up again after the next read
+*/
+class FrameReader
+{
+public:
+
+	enum class Status : uint8_t
+	{
+		Frame,
+		NeedMore,
+		// the header asks for more than max_frame bytes. the connection can not be trusted after this
+		TooLarge,
+	};
+
+	FrameReader(size_t max_frame) :
+		m_max_frame(max_frame)
+	{}
+
+	// returns space for at least size more bytes. commit says how many were written to it
+	char *prepare(size_t size);
+
+	void commit(size_t size);
+
+	// sets frame to the payload of the next complete frame. it stays valid until compact is called
+	Status next(std::string_view &frame);
+
+	// drops the frames handed out so far and moves a partial frame to the front
+	void compact();
+
+	inline size_t buffered() const
+	{
+		return m_end - m_start;
+	}
+
+private:
+	enum class State : uint8_t
+	{
+		Header,
+		Body,
+	};
+
+	State m_state = State::Header;
+	uint32_t m_length = 0;
+
+	size_t m_max_frame;
+
+	std::string m_buff;
+	// the first byte that has not been handed out and one past the last byte read
+	size_t m_start = 0;
+	size_t m_end = 0;
+};
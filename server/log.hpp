@@ -10,7 +10,7 @@ static constexpr uint8_t LOG_FILE = 0X2;
 static std::string time_str()
 {
 	time_t tt;
-	tm *info;
+	tm info;
 
 	std::string buff;
 
@@ -20,9 +20,10 @@ static std::string time_str()
 
 	time(&tt);
 
-	info = localtime(&tt);
+	// workers log from several threads so the reentrant version is used
+	localtime_r(&tt, &info);
 
-	strftime(buff.data(), MAX_LEN, "%x %X", info);
+	strftime(buff.data(), MAX_LEN, "%x %X", &info);
 
 	return buff;
 }
@@ -8,7 +8,40 @@
 
 #include "flags.hpp"
 
-SockOpt init_opts(int argc, char **argv)
+struct PreloadOpts
+{
+	std::vector<std::string> names;
+	size_t threads;
+};
+
+struct SlowlogOpts
+{
+	uint64_t threshold_us;
+	size_t max;
+};
+
+std::vector<std::string> split(std::string_view str, char delim)
+{
+	std::vector<std::string> output;
+
+	while (!str.empty())
+	{
+		size_t pos = str.find(delim);
+
+		output.emplace_back(str.substr(0, pos));
+
+		if (pos == std::string_view::npos)
+		{
+			break;
+		}
+
+		str.remove_prefix(pos+1);
+	}
+
+	return output;
+}
+
+SockOpt init_opts(int argc, char **argv, PreloadOpts &preload, SlowlogOpts &slowlog)
 {
 	flag::Parser parser(std::span{argv, (size_t)argc}, {
         .flag_prefix = "-",
@@ -59,6 +92,55 @@ SockOpt init_opts(int argc, char **argv)
 			.type = flag::Number,
 			.aliases = {"ps"},
 		})
+		.set({
+			.name = "preload",
+			.description = "a comma separated list of databases to open in the background on startup",
+			.data = "",
+			.type = flag::String,
+			.aliases = {"pl"},
+		})
+		.set({
+			.name = "preload_threads",
+			.description = "the number of threads used to preload databases (0 uses every core)",
+			.data = 0.f,
+			.type = flag::Number,
+			.aliases = {"plt"},
+		})
+		.set({
+			.name = "workers",
+			.description = "the number of threads serving connections, each with its own listening socket (0 uses every core)",
+			.data = 0.f,
+			.type = flag::Number,
+			.aliases = {"w"},
+		})
+		.set({
+			.name = "max_message",
+			.description = "the largest message in bytes a client may send before its connection is closed",
+			.data = float(64 << 20),
+			.type = flag::Number,
+			.aliases = {"mm"},
+		})
+		.set({
+			.name = "high_water",
+			.description = "the response bytes a connection may have waiting before the server stops reading its messages",
+			.data = float(8 << 20),
+			.type = flag::Number,
+			.aliases = {"hw"},
+		})
+		.set({
+			.name = "slowlog_threshold",
+			.description = "commands that run for at least this many microseconds are added to the slow log",
+			.data = 10000.f,
+			.type = flag::Number,
+			.aliases = {"slt"},
+		})
+		.set({
+			.name = "slowlog_len",
+			.description = "the most commands the slow log keeps",
+			.data = 128.f,
+			.type = flag::Number,
+			.aliases = {"sll"},
+		})
 		.parse();
 
 	if (!result.ok())
@@ -68,7 +150,7 @@ SockOpt init_opts(int argc, char **argv)
 
 #define GET(t, id) std::get<t>(parser.get(id).value()->data)
 
-	uint8_t transports;
+	uint8_t transports = 0;
 
 	if (GET(flag::Bool, "tfile"))
 	{
@@ -88,8 +170,22 @@ SockOpt init_opts(int argc, char **argv)
 		.log_transports = transports,
 		.backlog = int(GET(flag::Number, "backlog")),
 		.max_epoll_size = int(GET(flag::Number, "poll_size")),
+		.workers = int(GET(flag::Number, "workers")),
+		.max_message = size_t(GET(flag::Number, "max_message")),
+		.high_water = size_t(GET(flag::Number, "high_water")),
 	};
 
+	if (opt.workers <= 0)
+	{
+		opt.workers = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	preload.names = split(GET(flag::String, "preload"), ',');
+	preload.threads = size_t(GET(flag::Number, "preload_threads"));
+
+	slowlog.threshold_us = uint64_t(GET(flag::Number, "slowlog_threshold"));
+	slowlog.max = size_t(GET(flag::Number, "slowlog_len"));
+
 #undef GET
 
 	return opt;
@@ -97,7 +193,10 @@ SockOpt init_opts(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
-	SockOpt opt = init_opts(argc, argv);
+	PreloadOpts preload;
+	SlowlogOpts slowlog;
+
+	SockOpt opt = init_opts(argc, argv, preload, slowlog);
 
 	Server server(opt);
 
@@ -111,5 +210,10 @@ int main(int argc, char **argv)
 
 	inter.init_commands();
 
+	inter.slowlog_threshold = slowlog.threshold_us * 1000;
+	inter.slowlog_max = slowlog.max;
+
+	inter.preload(preload.names, preload.threads);
+
 	server.command_loop(inter);
 }
\ No newline at end of file
@@ -3,9 +3,12 @@
 
 #include <arpa/inet.h>
 
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #define LOG(level, message, ...) \
 	if (m_opt.verbose) \
@@ -21,131 +24,375 @@
 
 void Server::start()
 {
-	m_ci = init(m_opt);
+	m_wake_fd = eventfd(0, EFD_NONBLOCK);
 
-	if (!m_ci.ok())
+	SockOpt opt = m_opt;
+
+	opt.reuse_port = m_opt.workers > 1;
+
+	// an ephemeral port is picked by the first socket and the rest bind the same one
+	std::string port;
+
+	for (int i = 0; i < std::max(m_opt.workers, 1); i++)
 	{
-		LOG(fatal, m_ci.err);
-		return;
-	}
+		auto worker = std::make_unique<Worker>();
+
+		worker->ci = init(opt);
+
+		if (!worker->ci.ok())
+		{
+			LOG(fatal, worker->ci.err);
+			return;
+		}
+
+		// accepting happens on the worker thread so it must never block
+		fcntl(worker->ci.fd, F_SETFL, fcntl(worker->ci.fd, F_GETFL) | O_NONBLOCK);
+
+		worker->epoll_fd = epoll_create1(0);
+
+		epoll_event event {};
+
+		event.data.fd = worker->ci.fd;
+		event.events = EPOLLIN;
+
+		epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->ci.fd, &event);
+
+		event.data.fd = m_wake_fd;
 
-	LOG(info, "started on {}:{}", m_ci.ipstr, m_ci.port);
+		epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &event);
 
-	m_epoll_fd = epoll_create1(0);
+		if (i == 0)
+		{
+			port = std::to_string(worker->ci.port);
+			opt.service = port;
+		}
+
+		m_workers.push_back(std::move(worker));
+	}
+
+	LOG(info, "started on {}:{} with {} workers", m_workers[0]->ci.ipstr, m_workers[0]->ci.port, m_workers.size());
 }
 
 void Server::listen()
 {
-	int status = ::listen(m_ci.fd, m_opt.backlog);
+	for (auto &worker : m_workers)
+	{
+		if (::listen(worker->ci.fd, m_opt.backlog) == -1)
+		{
+			LOG_ERRNO(fatal);
+		}
+	}
+}
+
+void Server::accept_all(Worker &worker, aci::Interpreter &inter)
+{
+	char ip_str[INET6_ADDRSTRLEN];
 
-	if (status == -1)
+	sockaddr_storage client;
+
+	while (true)
 	{
-		LOG_ERRNO(fatal);
+		socklen_t sin_size = sizeof(client);
+
+		// connections are non-blocking so a client that stops half way through a message never stalls the worker
+		int cfd = accept4(worker.ci.fd, (sockaddr*)&client, &sin_size, SOCK_NONBLOCK);
+
+		if (cfd == -1)
+		{
+			// another worker may have taken the connection first
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				LOG(warn, strerror(errno));
+			}
+
+			return;
+		}
+
+		inet_ntop(client.ss_family, in_addr((sockaddr*)&client), ip_str, sizeof(ip_str));
+
+		LOG(info, "accepted connection from {}", ip_str);
+
+		epoll_event event;
+
+		event.data.fd = cfd;
+		event.events = EPOLLIN;
+
+		if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, cfd, &event) == -1)
+		{
+			LOG_ERRNO(warn);
+			::close(cfd);
+			continue;
+		}
+
+		auto [iter, _] = worker.cons.emplace(cfd, m_opt.max_message);
+
+		inter.start_session(iter->second.session);
+
+		worker.accepted++;
 	}
+}
 
-	m_listener = std::thread
+void Server::disconnect(Worker &worker, aci::Interpreter &inter, int fd)
+{
+	auto iter = worker.cons.find(fd);
+
+	if (iter != worker.cons.end())
 	{
-		[&]
+		if (iter->second.paused)
 		{
-			char ip_str[INET6_ADDRSTRLEN];
+			worker.paused--;
+		}
 
-			sockaddr_storage client;
+		inter.end_session(iter->second.session);
+		worker.cons.erase(iter);
+	}
 
-			while (m_running)
-			{
-				socklen_t sin_size = sizeof(client);
+	epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+	::close(fd);
+	worker.closed++;
+}
+
+/*
+	one byte for the status code
+	four bytes for the length of the message
+	then the message
+*/
+void put_responce(std::string &out, const aci::Result &result)
+{
+	size_t at = out.size();
 
-				int cfd = accept(m_ci.fd, (sockaddr*)&client, &sin_size);
+	out.resize(at + 5 + result.message.size());
 
-				if (cfd == -1)
-				{
-					LOG(warn, strerror(errno));
-					continue;
-				}
+	out[at] = (uint8_t)result.type;
 
-				inet_ntop(client.ss_family, in_addr((sockaddr*)&client), ip_str, sizeof(ip_str));
+	uint32_t size = result.message.size();
 
-				LOG(info, "accepted connection from {}", ip_str);
+	memcpy(out.data()+at+1, (char*)&size, 4);
+	memcpy(out.data()+at+5, result.message.data(), result.message.size());
+}
 
-				epoll_event event;
+// how much is read from a connection at a time and at most before the other connections get a turn
+static constexpr size_t READ_SIZE = 16 << 10;
+static constexpr size_t READ_BUDGET = 1 << 20;
 
-				event.data.fd = cfd;
-				event.events = EPOLLIN | EPOLLRDHUP;
+// an output buffer that grew past this for a large responce is given back once it is written
+static constexpr size_t KEEP_SIZE = 1 << 20;
 
-				int status = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, cfd, &event);
+bool Server::read_from(Worker &worker, int fd, Connection &con)
+{
+	for (size_t budget = READ_BUDGET; budget > 0;)
+	{
+		ssize_t n = ::recv(fd, con.reader.prepare(READ_SIZE), READ_SIZE, 0);
 
-				if (status == -1)
-				{
-					LOG_ERRNO(warn);
-					continue;
-				}
+		if (n > 0)
+		{
+			con.reader.commit(n);
 
-				m_cons.emplace(cfd);
+			worker.bytes_in += n;
+			budget -= std::min<size_t>(budget, n);
+
+			// a short read means the socket is empty. epoll is level triggered so anything left over wakes the worker again
+			if (size_t(n) < READ_SIZE)
+			{
+				break;
 			}
+
+			continue;
 		}
-	};
+
+		if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+
+		// 0 means the client closed the connection
+		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			LOG_ERRNO(warn);
+			return false;
+		}
+
+		return n != 0;
+	}
+
+	return true;
 }
 
-std::vector<Incoming> Server::recv_from_all(aci::Interpreter &inter, int timeout)
+void Server::run_messages(Worker &worker, aci::Interpreter &inter, aci::Commands &cmds, int fd, Connection &con)
 {
-	std::vector<epoll_event> events;
+	std::string_view message;
+	FrameReader::Status status = FrameReader::Status::NeedMore;
+
+	while (con.pending() <= m_opt.high_water && (status = con.reader.next(message)) == FrameReader::Status::Frame)
+	{
+		worker.messages++;
 
-	events.resize(m_opt.max_epoll_size);
+		run_message(worker, inter, cmds, fd, con, message);
+	}
 
-	int size = epoll_wait(m_epoll_fd, events.data(), events.size(), timeout);
+	con.reader.compact();
 
-	if (size <= 0)
+	if (status == FrameReader::Status::TooLarge)
 	{
-		if (size == -1)
+		put_responce(con.out, {ambry::ResultType::ParseError, "message is too large"});
+
+		// nothing after the bad header can be trusted so it is thrown away
+		con.reader = FrameReader(m_opt.max_message);
+		con.closing = true;
+	}
+
+	// the messages left in the reader wait until the client has read some of its responses
+	if (con.pending() > m_opt.high_water && !con.paused)
+	{
+		con.paused = true;
+		worker.paused++;
+	}
+}
+
+bool Server::flush(Worker &worker, int fd, Connection &con)
+{
+	while (con.pending() > 0)
+	{
+		// a client that went away gets an error instead of SIGPIPE taking the server down
+		ssize_t n = ::send(fd, con.out.data() + con.out_start, con.pending(), MSG_NOSIGNAL);
+
+		if (n == -1)
 		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			// the socket buffer is full. the rest goes out once epoll says there is room
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+
 			LOG_ERRNO(warn);
+			return false;
 		}
 
-		return {};
+		con.out_start += n;
+		worker.bytes_out += n;
 	}
 
-	std::vector<Incoming> messages;
+	if (con.pending() == 0)
+	{
+		con.out_start = 0;
 
-	messages.reserve(size);
+		if (con.out.capacity() > KEEP_SIZE)
+		{
+			con.out = {};
+		}
+		else
+		{
+			con.out.clear();
+		}
+	}
+	// drops what was sent so a client that never quite catches up does not grow the buffer forever
+	else if (con.out_start > con.out.size() / 2)
+	{
+		con.out.erase(0, con.out_start);
+		con.out_start = 0;
+	}
 
-	for (int i = 0; i < size; i++)
+	return true;
+}
+
+void Server::update_events(Worker &worker, int fd, Connection &con)
+{
+	uint32_t events = 0;
+
+	if (!con.paused && !con.closing)
 	{
-		int fd = events[i].data.fd;
+		events |= EPOLLIN;
+	}
 
-		if (events[i].events & EPOLLRDHUP)
+	if (con.pending() > 0)
+	{
+		events |= EPOLLOUT;
+	}
+
+	if (events == con.events)
+	{
+		return;
+	}
+
+	epoll_event event {};
+
+	event.data.fd = fd;
+	event.events = events;
+
+	if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1)
+	{
+		LOG_ERRNO(warn);
+		return;
+	}
+
+	con.events = events;
+}
+
+void Server::serve(Worker &worker, aci::Interpreter &inter, aci::Commands &cmds, int fd, uint32_t events)
+{
+	auto iter = worker.cons.find(fd);
+
+	if (iter == worker.cons.end())
+	{
+		return;
+	}
+
+	Connection &con = iter->second;
+
+	if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !con.paused && !con.closing)
+	{
+		// messages sent before the client closed the connection are still run
+		if (!read_from(worker, fd, con))
 		{
-			m_cons.erase(fd);
-			inter.logins.erase(fd);
-			epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-			continue;
+			con.closing = true;
 		}
 
-		auto [m, n] = recvall(fd, 4);
+		run_messages(worker, inter, cmds, fd, con);
+	}
 
-		if (n <= 0)
+	// the responces of every message read this time go out together and whatever does not fit waits for EPOLLOUT
+	while (true)
+	{
+		if (!flush(worker, fd, con))
 		{
-			LOG_ERRNO(warn);
-			continue;
+			disconnect(worker, inter, fd);
+			return;
 		}
 
-		auto len_bytes = m.substr(0, 4);
-		auto len = *(uint32_t*)len_bytes.data();
+		// picks up again once half of what was waiting has been read so the client is not paused again straight away
+		if (!con.paused || con.pending() > m_opt.high_water / 2)
+		{
+			break;
+		}
 
-		auto [data, n2] = recvall(fd, len);
+		con.paused = false;
+		worker.paused--;
 
-		messages.emplace_back(Incoming { std::move(data), fd });
+		run_messages(worker, inter, cmds, fd, con);
 	}
 
-	return messages;
+	if (con.closing && !con.paused && con.pending() == 0)
+	{
+		disconnect(worker, inter, fd);
+		return;
+	}
+
+	update_events(worker, fd, con);
 }
 
 void Server::stop()
 {
 	m_running = false;
 
-	if (m_listener.joinable())
+	if (m_wake_fd != -1)
 	{
-		m_listener.join();
+		uint64_t one = 1;
+		write(m_wake_fd, &one, sizeof(one));
 	}
 }
 
@@ -153,68 +400,196 @@ void Server::close()
 {
 	stop();
 
-	::close(m_ci.fd);
-	::close(m_epoll_fd);
-}
-
-/*
-	one byte for the status code
-	four bytes for the length of the message
-	then the message
-*/
-std::string construct_responce(const aci::Result &result)
-{
-	std::string buff;
+	for (auto &worker : m_workers)
+	{
+		for (auto &[fd, _] : worker->cons)
+		{
+			::close(fd);
+		}
 
-	buff.resize(5 + result.message.size());
+		::close(worker->ci.fd);
+		::close(worker->epoll_fd);
+	}
 
-	buff[0] = (uint8_t)result.type;
+	m_workers.clear();
 
-	uint32_t size = result.message.size();
+	if (m_wake_fd != -1)
+	{
+		::close(m_wake_fd);
+		m_wake_fd = -1;
+	}
+}
 
-	memcpy(buff.data()+1, (char*)&size, 4);
-	memcpy(buff.data()+5, result.message.data(), result.message.size());
 
-	return buff;
+std::string_view from_who(const aci::Session &session)
+{
+	return session.login ? std::string_view(session.login->name) : "Unknown";
 }
 
-std::string_view from_who(int fd, aci::Interpreter &inter)
+void Server::run_message(Worker &worker, aci::Interpreter &inter, aci::Commands &cmds, int fd, Connection &con, std::string_view message)
 {
-	auto iter = inter.logins.find(fd);
-
-	if (iter == inter.logins.end())
+	if (con.session.protocol == aci::Protocol::Binary)
+	{
+		// unlike text a malformed binary message gets a responce so the client is not left waiting
+		if (!aci::parse_binary(message, cmds))
+		{
+			put_responce(con.out, {ambry::ResultType::ParseError, "malformed binary message"});
+			return;
+		}
+	}
+	else
 	{
-		return "Unknown";
+		LOG(info, "recieved message: {}", message);
+
+		if (!aci::parse(message, cmds))
+		{
+			return;
+		}
 	}
 
-	return iter->second.name;
+	for (auto &c : cmds)
+	{
+		aci::Result result = inter.interpret(c, con.session);
+
+		LOG(info, "'{}' executed by {}", c.cmd, from_who(con.session));
+
+		put_responce(con.out, result);
+	}
 }
 
-void Server::command_loop(aci::Interpreter &inter)
+void Server::run_worker(Worker &worker, aci::Interpreter &inter)
 {
-	while (true)
+	// kept across messages so parsing does not allocate once it has seen a few
+	aci::Commands cmds;
+
+	std::vector<epoll_event> events(m_opt.max_epoll_size);
+
+	while (m_running)
 	{
-		auto messages = recv_from_all(inter, -1);
+		auto wait_start = Clock::now();
+
+		// lets the stats command count a wait that is still going on
+		worker.wait_start = std::chrono::duration_cast<std::chrono::nanoseconds>(wait_start.time_since_epoch()).count();
 
-		for (auto &[m, fd] : messages)
-		{	
-			LOG(info, "recieved message: {}", m);
+		int size = epoll_wait(worker.epoll_fd, events.data(), events.size(), -1);
 
-			auto cmd = aci::parse(m);
+		worker.idle_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - wait_start).count();
+		worker.wait_start = 0;
 
-			if (cmd.empty())
+		if (size == -1 && errno != EINTR)
+		{
+			LOG_ERRNO(warn);
+		}
+
+		for (int i = 0; i < size; i++)
+		{
+			int fd = events[i].data.fd;
+
+			if (fd == worker.ci.fd)
 			{
+				accept_all(worker, inter);
 				continue;
 			}
 
-			for (auto &c : cmd)
+			if (fd == m_wake_fd)
 			{
-				aci::Result result = inter.interpret(c, fd);
+				continue;
+			}
 
-				LOG(info, "'{}' executed by {}", c.cmd, from_who(fd, inter));
+			serve(worker, inter, cmds, fd, events[i].events);
+		}
+	}
+}
 
-				send(construct_responce(result), fd);
-			}
+void Server::command_loop(aci::Interpreter &inter)
+{
+	if (m_workers.empty())
+	{
+		return;
+	}
+
+	m_loop_start = Clock::now();
+
+	inter.server_stats = [this](aci::StatFields &out) { add_stats(out); };
+
+	std::vector<std::thread> threads;
+
+	// every worker records database metrics to a shard of its own
+	for (size_t i = 1; i < m_workers.size(); i++)
+	{
+		threads.emplace_back([this, &inter, i]
+		{
+			ambry::Metrics::bind_thread(i);
+			run_worker(*m_workers[i], inter);
+		});
+	}
+
+	ambry::Metrics::bind_thread(0);
+	run_worker(*m_workers[0], inter);
+
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+
+	// the sessions go away with the connections so the interpreter must not keep them
+	for (auto &worker : m_workers)
+	{
+		for (auto &[_, con] : worker->cons)
+		{
+			inter.end_session(con.session);
 		}
 	}
-}
\ No newline at end of file
+}
+
+void Server::add_stats(aci::StatFields &out) const
+{
+	auto now = Clock::now();
+
+	uint64_t uptime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_loop_start).count();
+
+	uint64_t accepted = 0, closed = 0, paused = 0, messages = 0, bytes_in = 0, bytes_out = 0, busy_ns = 0, idle_ns = 0;
+
+	for (auto &worker : m_workers)
+	{
+		accepted += worker->accepted;
+		closed += worker->closed;
+		paused += worker->paused;
+		messages += worker->messages;
+		bytes_in += worker->bytes_in;
+		bytes_out += worker->bytes_out;
+
+		uint64_t idle = std::min<uint64_t>(worker->idle(now), uptime_ns);
+
+		idle_ns += idle;
+		busy_ns += uptime_ns - idle;
+	}
+
+	auto ratio = [](uint64_t busy, uint64_t idle)
+	{
+		return std::to_string(busy + idle ? double(busy) / (busy + idle) : 0);
+	};
+
+	out.emplace_back("server.uptime_seconds", std::to_string(uptime_ns / 1'000'000'000));
+	out.emplace_back("server.workers", std::to_string(m_workers.size()));
+	out.emplace_back("server.connections", std::to_string(accepted - closed));
+	out.emplace_back("server.connections_total", std::to_string(accepted));
+	out.emplace_back("server.connections_paused", std::to_string(paused));
+	out.emplace_back("server.messages", std::to_string(messages));
+	out.emplace_back("server.bytes_in", std::to_string(bytes_in));
+	out.emplace_back("server.bytes_out", std::to_string(bytes_out));
+	out.emplace_back("server.loop_busy_ns", std::to_string(busy_ns));
+	out.emplace_back("server.loop_idle_ns", std::to_string(idle_ns));
+	out.emplace_back("server.loop_utilization", ratio(busy_ns, idle_ns));
+
+	// lets a worker that ended up with more than its share of connections be spotted
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		auto &worker = *m_workers[i];
+
+		uint64_t idle = std::min<uint64_t>(worker.idle(now), uptime_ns);
+
+		out.emplace_back(fmt::format("server.worker.{}.connections", i), std::to_string(worker.accepted - worker.closed));
+		out.emplace_back(fmt::format("server.worker.{}.loop_utilization", i), ratio(uptime_ns - idle, idle));
+	}
+}
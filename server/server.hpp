@@ -2,24 +2,96 @@
 
 #include <sys/epoll.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "framing.hpp"
 #include "socket_util.hpp"
 #include "log.hpp"
 
 #include "aci.hpp"
 
-struct Incoming
+// what a worker keeps for each of its connections
+struct Connection
 {
-	std::string message;
-	int fd;
+	FrameReader reader;
+
+	// the login, working db and protocol of the connection. only the worker serving it runs its commands
+	aci::Session session;
+
+	// responses that have not been written yet. everything before out_start was already sent
+	std::string out;
+	size_t out_start = 0;
+
+	// what the connection is registered for in epoll
+	uint32_t events = EPOLLIN;
+
+	// the client is not reading its responses so its messages are left alone until it does
+	bool paused = false;
+
+	// no more messages are run and the connection is closed once out is written
+	bool closing = false;
+
+	Connection(size_t max_message) :
+		reader(max_message)
+	{}
+
+	inline size_t pending() const
+	{
+		return out.size() - out_start;
+	}
+};
+
+/*
+	a thread with its own listening socket and epoll instance. the kernel spreads new connections
+	over the listening sockets (SO_REUSEPORT) and a connection stays on the worker that accepted it,
+	so workers never share a connection and only meet inside the interpreter
+*/
+struct Worker
+{
+	using Clock = std::chrono::steady_clock;
+
+	ConInfo ci;
+	int epoll_fd = -1;
+
+	// only touched by the worker itself
+	std::unordered_map<int, Connection> cons;
+
+	// read by the stats command from whichever worker runs it
+	std::atomic<uint64_t> accepted{};
+	std::atomic<uint64_t> closed{};
+	std::atomic<uint64_t> messages{};
+	std::atomic<uint64_t> bytes_in{};
+	std::atomic<uint64_t> bytes_out{};
+	std::atomic<uint64_t> paused{};
+
+	// the worker is idle while it waits in epoll_wait and busy the rest of the time
+	std::atomic<uint64_t> idle_ns{};
+
+	// when the current wait in epoll_wait began, in nanoseconds of Clock. 0 while the worker is busy
+	std::atomic<int64_t> wait_start{};
+
+	// the idle time so far, counting a wait that has not ended yet
+	inline uint64_t idle(Clock::time_point now) const
+	{
+		uint64_t idle = idle_ns;
+		int64_t start = wait_start;
+
+		int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+
+		return start ? idle + std::max<int64_t>(now_ns - start, 0) : idle;
+	}
 };
 
 class Server
 {
 public:
-	
+
 	Server(SockOpt opt) :
 		m_opt(opt),
 		m_lgr(m_opt.log_transports, "server.log")
@@ -30,40 +102,67 @@ public:
 		close();
 	}
 
+	// opens a listening socket for every worker
 	void start();
 
 	inline ConInfo info() const
 	{
-		return m_ci;
+		return m_workers.empty() ? ConInfo("server is not started") : m_workers.front()->ci;
 	}
 
 	void listen();
 
+	// wakes every worker and makes command_loop return
 	void stop();
 
 	void close();
 
-	std::vector<Incoming> recv_from_all(aci::Interpreter &inter, int timeout = -1);
-	
+	// runs a worker on this thread and the rest on their own threads until stop is called
 	void command_loop(aci::Interpreter &inter);
 
+	// adds the server fields of the stats command
+	void add_stats(aci::StatFields &out) const;
+
 	inline int fd() const
 	{
-		return m_ci.fd;
+		return m_workers.empty() ? -1 : m_workers.front()->ci.fd;
 	}
 
 private:
 	SockOpt m_opt;
-	ConInfo m_ci;
 	Logger m_lgr;
 
-	std::set<int> m_cons;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	std::atomic<bool> m_running = true;
+
+	// written by stop so workers blocked in epoll_wait wake up
+	int m_wake_fd = -1;
 
-	std::thread m_listener;
+	using Clock = Worker::Clock;
 
-	bool m_running = true;
+	Clock::time_point m_loop_start;
 
-	std::mutex m_mutex;
+	void accept_all(Worker &worker, aci::Interpreter &inter);
 
-	int m_epoll_fd;
-};
\ No newline at end of file
+	void run_worker(Worker &worker, aci::Interpreter &inter);
+
+	// handles an epoll event for a connection, closing it when it is done
+	void serve(Worker &worker, aci::Interpreter &inter, aci::Commands &cmds, int fd, uint32_t events);
+
+	// reads what a connection has sent into its frame reader. returns false once nothing more will come
+	bool read_from(Worker &worker, int fd, Connection &con);
+
+	// runs the complete messages a connection has sent until its responses pass the high water mark
+	void run_messages(Worker &worker, aci::Interpreter &inter, aci::Commands &cmds, int fd, Connection &con);
+
+	void run_message(Worker &worker, aci::Interpreter &inter, aci::Commands &cmds, int fd, Connection &con, std::string_view message);
+
+	// writes as much of the waiting responses as the socket takes. returns false if the connection broke
+	bool flush(Worker &worker, int fd, Connection &con);
+
+	// sets the epoll events to what the connection is waiting for
+	void update_events(Worker &worker, int fd, Connection &con);
+
+	void disconnect(Worker &worker, aci::Interpreter &inter, int fd);
+};
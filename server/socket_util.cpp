@@ -39,6 +39,11 @@ int bind_sock(int fd, addrinfo *ai, SockOpt opt)
 
 	TRY(setsockopt(fd, SOL_SOCKET, opt.opt_name, &yes, sizeof(int)));
 
+	if (opt.reuse_port)
+	{
+		TRY(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)));
+	}
+
 	TRY(bind(fd, ai->ai_addr, ai->ai_addrlen));
 
 	return 0;
@@ -167,25 +172,4 @@ std::pair<std::string, int> recvall(int fd, size_t size)
 	}
 
 	return {buff, got};
-}
-
-int send(std::string_view message, int fd)
-{
-	int sent{};
-	int n{};
-	int size = message.size();
-	
-	while (sent < size)
-	{
-		n = send(fd, message.data()+sent, size-sent, 0);
-
-		if (n == -1)
-		{
-			break;
-		}
-
-		sent += n;
-	}
-
-	return sent;
 }
\ No newline at end of file
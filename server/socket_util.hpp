@@ -18,6 +18,9 @@ struct SockOpt
 
 	int opt_name = SO_REUSEADDR;
 
+	// lets several sockets bind the same port so the kernel spreads connections over them
+	bool reuse_port = false;
+
 	SockAct sock_act;
 
 	bool verbose = true;
@@ -27,6 +30,15 @@ struct SockOpt
 	int backlog = 20;
 
 	int max_epoll_size = 256;
+
+	// the number of threads serving connections, each with its own listening socket
+	int workers = 1;
+
+	// the largest message a client may send. a connection asking to send more is closed
+	size_t max_message = 64 << 20;
+
+	// once a connection has this many response bytes waiting its messages are not read until the client catches up
+	size_t high_water = 8 << 20;
 };
 
 struct ConInfo
@@ -60,5 +72,3 @@ void* in_addr(sockaddr *addr);
 
 std::pair<std::string, int> recv(int fd, size_t max_size = 1024);
 std::pair<std::string, int> recvall(int fd, size_t size);
-
-int send(std::string_view message, int fd);